@@ -3,19 +3,11 @@
  */
 
 #include "LC4.h"
+#include "decode.h"
+#include "tracefmt.h"
+#include "phases.h"
 #include <stdio.h>
 
-//macros
-#define INSN_OP(I) ((I) >> 12)
-#define INSN_11_9(I) (((I) >> 9) & 0x7)
-#define INSN_IMM9(I) ((short)(I) & 0x1FF) // extracts 9-bit immediate value (bits [8:0])
-#define INSN_8_6(I) (((I) >> 6) & 0x7) // extracts bits 8:6 for rs
-#define INSN_8_0(I) (((I) >> 0) & 0x1FF) // extracts bits 8:0 for br imm
-#define INSN_2_0(I) ((I) & 0x7) // extracts bits 2:0 for rt
-#define INSN_IMM5(I) ((short)(I) & 0x1F) // extracts 5 bit immediate value [4:0]
-#define INSN_IMM7(I) ((short)(I) & 0x7F) // extracts 7 bit immediate value [6:0]
-
-int error = 0;
 
 /*
  * Reset the machine state as Pennsim would do
@@ -24,6 +16,7 @@ void Reset(MachineState* CPU) {
     //initialize pc to default starting pc, as well as psr's 16th bit to 1
     CPU->PC = 0x8200;
     CPU->PSR |= (1 << 15);
+    CPU->error = 0;
     CPU->R[0] = 0;
     CPU->R[1] = 0;
     CPU->R[2] = 0;
@@ -34,6 +27,8 @@ void Reset(MachineState* CPU) {
     CPU->R[7] = 0;
     //reset signals
     ClearSignals(CPU);
+    //memory is about to be (re)loaded so forget any decoded instructions
+    InvalidateDecodeCache(CPU);
 }
 
 
@@ -59,68 +54,31 @@ void ClearSignals(MachineState* CPU) {
  out the current state of the CPU to the file output.
  */
 void WriteOut(MachineState* CPU, FILE* output) {
-    //print current pc in hex
-    fprintf(output, "%04X ", CPU->PC);
-    //convert the instruction into binary by looping through it in memory
-    unsigned short instruction = CPU->memory[CPU->PC];
-    char binaryInstruction[17];
-    for (int i = 15; i >= 0; i--) {
-        binaryInstruction[15-i] = (instruction & (1 << i)) ? '1' : '0';
-    }
-    //null terminate the string
-    binaryInstruction[16] = '\0';
-    //print instruction
-    fprintf(output, "%s ", binaryInstruction);
-    
-    //print regFile_WE
-    fprintf(output, "%01X ", CPU->regFile_WE);
-    
-    //if regFile_WE is high, print rdMux_CTL and regInputVal
-    if (CPU->regFile_WE) {
-        fprintf(output, "%01X ", CPU->rdMux_CTL);
-        fprintf(output, "%04X ", CPU->regInputVal);
-    } else {
-        fprintf(output, "0 0000 ");
-    }
-
-    //print NZP_WE
-    fprintf(output, "%01X ", CPU->NZP_WE);
-    
-    //if NZP_WE is high, print NZP val
-    if (CPU->NZP_WE) {
-        fprintf(output, "%01X ", CPU->NZPVal);
-    } else {
-        fprintf(output, "0 ");
-    }
-
-    //print DATA_WE
-    fprintf(output, "%01X ", CPU->DATA_WE);
-    
-    //if DATA_WE is high, print dmem address and dmem value
-    if (CPU->DATA_WE) {
-        fprintf(output, "%04X ", CPU->dmemAddr);
-        fprintf(output, "%04X", CPU->dmemValue);
-    } else {
-        fprintf(output, "0000 0000");
+    //nothing to do when running without a trace
+    if (output == NULL) {
+        return;
     }
-    fprintf(output, "\n");
+    //render the whole fixed width line with the lookup tables in tracefmt.c and write it at once
+    char line[TRACE_LINE_LENGTH];
+    PhaseScope scope = PhaseBegin();
+    FormatStateLine(line, CPU);
+    PhaseEnd(PHASE_FORMAT, scope, 1);
+    scope = PhaseBegin();
+    fwrite(line, 1, TRACE_LINE_LENGTH, output);
+    PhaseEnd(PHASE_WRITE, scope, TRACE_LINE_LENGTH);
 }
 
 /*
  * Parses rest of const operation and updates state of machine.
  */
 void constOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
     CPU->regFile_WE = 1;
     //get destination register to put in rdMux_CTL
-    unsigned char rd = INSN_11_9(instruction);
+    unsigned char rd = insn->rd;
     CPU->rdMux_CTL = rd;
-    //get immediate value to put in regInputVal
-    short immediate_val = INSN_IMM9(instruction);
-    //make sure we handle sext by extending 16 bits if top bit is set
-    if (immediate_val & 0x100) {
-        immediate_val |= 0xFE00; 
-    }
+    //get immediate value to put in regInputVal (already sign extended by the decoder)
+    short immediate_val = insn->imm;
     //update registers and control signals
     CPU->regInputVal = immediate_val;
     CPU->R[rd] = immediate_val;
@@ -154,11 +112,11 @@ void rtiOp(MachineState* CPU, FILE* output) {
  * Parses rest of trap operation and updates state of machine.
  */
 void trapOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
     //save return address before jumping into trap
     CPU->R[7] = CPU->PC + 1;
-    //extract lowest 8 bits for trap bits
-    unsigned char trap = instruction & 0xFF;
+    //lowest 8 bits are the trap bits
+    unsigned char trap = insn->imm;
     //set signals and NZP bits
     CPU->regFile_WE = 1;
     CPU->NZP_WE = 1;
@@ -180,16 +138,15 @@ void trapOp(MachineState* CPU, FILE* output) {
  * Parses rest of hiconst operation and updates state of machine.
  */
 void hiconstOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
     //make sure hiconst is valid
-    unsigned char check = (instruction >> 8) & 0x1;
-    if (check != 1) {
-        error = 1;
+    if (insn->op != OP_HICONST) {
+        CPU->error = 1;
         return;
     }
     //save dest reg and imm8
-    unsigned char rd = INSN_11_9(instruction);
-    unsigned char imm = instruction & 0xFF;
+    unsigned char rd = insn->rd;
+    unsigned char imm = insn->imm;
     //update highest 8 bits of rd
     CPU->R[rd] = (CPU->R[rd] & 0x0FF) | (imm << 8);
     //set signals and NZP bits
@@ -211,29 +168,27 @@ void hiconstOp(MachineState* CPU, FILE* output) {
  * Parses rest of str operation and updates state of machine.
  */
 void strOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    //extact rs and rt and imm6
-    unsigned char rs = INSN_8_6(instruction);
-    unsigned char rt = INSN_11_9(instruction);
-    short imm = (short)(instruction & 0x3F);
-    //sext imm
-    if (imm & 0x20) {
-        imm |= 0xFFC0;
-    }
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    //extact rs and rt and the sign extended imm6
+    unsigned char rs = insn->rs;
+    unsigned char rt = insn->rt;
+    short imm = insn->imm;
     unsigned short memAddress = CPU->R[rs] + imm;
     int isUserMode = (CPU->PSR >> 15) == 0;
     int isProtectedAddr = (memAddress < 0xFFFF && memAddress > 0xA000) && isUserMode;
     int isInvalidAddr = (memAddress < 0x1FFF || (memAddress > 0x8000 && memAddress < 0x9FFF));
     if (isProtectedAddr || isInvalidAddr) {
-        error = 1;
+        CPU->error = 1;
         return;
     }
     if (rs == rt) {
-      error = 1;
+      CPU->error = 1;
       return;
     }
-    //Update memoryAddress
-    CPU->memory[CPU->R[rs] + imm] = CPU->R[rt];
+    //Update memoryAddress and drop any decoded copy of the old word
+    CPU->memory[memAddress] = CPU->R[rt];
+    MarkWritten(CPU, memAddress);
+    InvalidateDecoded(CPU, memAddress);
     //set signals and data
     CPU->regFile_WE = 0;
     CPU->NZP_WE = 0;
@@ -242,7 +197,7 @@ void strOp(MachineState* CPU, FILE* output) {
     CPU->rsMux_CTL = rs;
     CPU->rtMux_CTL = rt;
     
-    CPU->dmemAddr = CPU->R[rs] + imm;
+    CPU->dmemAddr = memAddress;
     CPU->dmemValue = CPU->R[rt];
     //writeout and update pc
     WriteOut(CPU, output);
@@ -253,30 +208,26 @@ void strOp(MachineState* CPU, FILE* output) {
  * Parses rest of ldr operation and updates state of machine.
  */
 void ldrOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    //extact rd and rs and imm6
-    unsigned char rs = INSN_8_6(instruction);
-    unsigned char rd = INSN_11_9(instruction);
-    short imm = (short)(instruction & 0x3F);
-    //sext imm
-    if (imm & 0x20) {
-        imm |= 0xFFC0;
-    }
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    //extact rd and rs and the sign extended imm6
+    unsigned char rs = insn->rs;
+    unsigned char rd = insn->rd;
+    short imm = insn->imm;
     unsigned short memAddress = CPU->R[rs] + imm;
     int isUserMode = (CPU->PSR >> 15) == 0;
     int isProtectedAddr = (memAddress < 0xFFFF && memAddress > 0xA000) && isUserMode;
     int isInvalidAddr = (memAddress < 0x1FFF || (memAddress > 0x8000 && memAddress < 0x9FFF));
     if (isProtectedAddr || isInvalidAddr) {
-        error = 1;
+        CPU->error = 1;
         return;
     }
     if (rs == rd) {
-      error = 1;
+      CPU->error = 1;
       return;
     }
 
     //Update memoryAddress and regInputVal to same val
-    CPU->R[rd] = CPU->memory[CPU->R[rs] + imm];
+    CPU->R[rd] = CPU->memory[memAddress];
     CPU->regInputVal = CPU->R[rd];
     //set signals and NZP
     CPU->regFile_WE = 1;
@@ -295,9 +246,6 @@ void ldrOp(MachineState* CPU, FILE* output) {
  * This function should execute one LC4 datapath cycle.
  */
 int UpdateMachineState(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    //extract opcode using macros
-    unsigned short opcode = INSN_OP(instruction);
     unsigned short ceiling = 0xFFFF;
 
     if (CPU->PC == 0x80FF) {
@@ -310,57 +258,75 @@ int UpdateMachineState(MachineState* CPU, FILE* output) {
         return 1;
     }
 
-    //go through different possible opcodes and make necessary updates
-    switch (opcode) {
-        case 9: {
+    //look up the predecoded instruction and dispatch to its handler
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    switch (insn->op) {
+        case OP_CONST: {
             constOp(CPU, output);
             break;
         }
-        case 1: {
+        case OP_ADD:
+        case OP_MUL:
+        case OP_SUB:
+        case OP_DIV:
+        case OP_ADDI: {
             ArithmeticOp(CPU, output);
             break;
         }
-        case 8: {
+        case OP_RTI: {
             rtiOp(CPU, output);
             break;
         }
-        case 0: {
+        case OP_BR: {
             BranchOp(CPU, output);
             break;
         }
-        case 15: {
+        case OP_TRAP: {
             trapOp(CPU, output);
             break;
         }
-        case 13: {
+        case OP_HICONST:
+        case OP_BADHICONST: {
             hiconstOp(CPU, output);
             break;
         }
-        case 7: {
+        case OP_STR: {
             strOp(CPU, output);
             break;
         }
-        case 6: {
+        case OP_LDR: {
             ldrOp(CPU, output);
             break;
         }
-        case 2: {
+        case OP_CMP:
+        case OP_CMPU:
+        case OP_CMPI:
+        case OP_CMPIU: {
             ComparativeOp(CPU, output);
             break;
         }
-        case 5: {
+        case OP_AND:
+        case OP_NOT:
+        case OP_OR:
+        case OP_XOR:
+        case OP_ANDI: {
             LogicalOp(CPU, output);
             break;
         }
-        case 12: {
+        case OP_JMPR:
+        case OP_JMP: {
             JumpOp(CPU, output);
             break;
         }
-        case 4: {
+        case OP_JSRR:
+        case OP_JSR: {
             JSROp(CPU, output);
             break;
         }
-        case 10: {
+        case OP_SLL:
+        case OP_SRA:
+        case OP_SRL:
+        case OP_MOD: {
             ShiftModOp(CPU, output);
             break;
         }
@@ -368,7 +334,7 @@ int UpdateMachineState(MachineState* CPU, FILE* output) {
             return 1;
         }
     }
-    if (error) {
+    if (CPU->error) {
         return 1;
     }
     return 0;
@@ -384,16 +350,11 @@ int UpdateMachineState(MachineState* CPU, FILE* output) {
  * Parses rest of branch operation and updates state of machine.
  */
 void BranchOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    short imm = instruction & 0x1FF; // Immediate 9-bit value (bits [8:0])
-    unsigned char condition = (instruction >> 9) & 0x7; // Branch condition (bits [11:9])
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    short imm = insn->imm; // Sign extended 9-bit immediate (bits [8:0])
+    unsigned char condition = insn->rd; // Branch condition (bits [11:9])
     unsigned char NZP = CPU->PSR & 0x7; // NZP condition codes in the PSR
 
-    // Sign extend the immediate value if necessary
-    if ((imm >> 8) & 0x1) {
-        imm |= 0xFE00;
-    }
-
     // Set control signals
     CPU->rsMux_CTL = 0;
     CPU->rtMux_CTL = 0;
@@ -433,55 +394,50 @@ void BranchOp(MachineState* CPU, FILE* output) {
  * Parses rest of arithmetic operation and prints out.
  */
 void ArithmeticOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    unsigned short opcode = INSN_OP(instruction);
-    //decode rd, rs, and rt from instruction
-    unsigned char rd = INSN_11_9(instruction);
-    unsigned char rs = INSN_8_6(instruction);
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    //rd, rs, and rt were decoded ahead of time
+    unsigned char rd = insn->rd;
+    unsigned char rs = insn->rs;
     unsigned char rt;
     int ans;
     short imm5;
     //determine type of operation and update ans
-    if ((instruction & 0x0020) == 0) {
+    if (insn->op != OP_ADDI) {
         //cannot be add imm5 so we can use rt
-        rt = INSN_2_0(instruction);
+        rt = insn->rt;
         CPU->rtMux_CTL = rt;
-        //check bits 5:3 to determine operation
-        switch ((instruction >> 3) & 0x7) {
+        switch (insn->op) {
             //add
-            case 0: {
+            case OP_ADD: {
                 ans = (short)CPU->R[rs] + (short)CPU->R[rt];
                 break;
             }
             //mult
-            case 1: {
+            case OP_MUL: {
                 ans = (short)CPU->R[rs] * (short)CPU->R[rt];
                 break;
             }
             //subtract
-            case 2: {
+            case OP_SUB: {
                 ans = (short)CPU->R[rs] - (short)CPU->R[rt];
                 break;
             }
             //divide
-            case 3: {
+            case OP_DIV: {
                 if (CPU->R[rt] == 0) {
-                    error = 1;
+                    CPU->error = 1;
                     return;
                 }
                 ans = (short)CPU->R[rs] / (short)CPU->R[rt];
                 break;
             }
             default:
-                error = 1;
+                CPU->error = 1;
                 return;
         }
     } else {
-        imm5 = INSN_IMM5(instruction);
-        //add sext if needed
-        if (imm5 & 0x10) {
-            imm5 |= 0xFFE0;
-        }
+        //imm5 is already sign extended
+        imm5 = insn->imm;
         ans = (short)CPU->R[rs] + imm5;
         //imm5 doesn't use rt
         CPU->rtMux_CTL = 0;
@@ -504,43 +460,31 @@ void ArithmeticOp(MachineState* CPU, FILE* output) {
  * Parses rest of comparative operation and prints out.
  */
 void ComparativeOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    unsigned char rs;
-    unsigned char rt;
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    //comparisons all read rs from bits 11:9
+    unsigned char rs = insn->rs;
+    unsigned char rt = insn->rt;
     short imm;
     short ans;
 
-    //check bits 8:7 to determine operation
-    switch ((instruction >> 7) & 0x3) {
-        case 0: {
-            //CMP
-            rs = INSN_11_9(instruction);
-            rt = INSN_2_0(instruction);
+    switch (insn->op) {
+        case OP_CMP: {
             ans = (short)CPU->R[rs] - (short)CPU->R[rt];
             break;
         }
-        case 1: {
-            //CMPU
-            rs = INSN_11_9(instruction);
-            rt = INSN_2_0(instruction);
+        case OP_CMPU: {
             ans = CPU->R[rs] - CPU->R[rt];
             break;
         }
-        case 2: {
-            //CMPI
-            rs = INSN_11_9(instruction);
-            imm = INSN_IMM7(instruction);
-            //sext imm if needed
-            if (imm & 0x40) {
-                imm |= 0xFF80;
-            }
+        case OP_CMPI: {
+            //imm7 is already sign extended
+            imm = insn->imm;
             ans = (short) CPU->R[rs] - imm;
             break;
         }
-        case 3: {
-            //CMPIU
-            rs = INSN_11_9(instruction);
-            unsigned short uimm = instruction & 0x7F;
+        default: {
+            //CMPIU, imm7 is zero extended
+            unsigned short uimm = insn->imm;
             ans = (unsigned short)CPU->R[rs] - uimm;
             break;
         }
@@ -561,40 +505,32 @@ void ComparativeOp(MachineState* CPU, FILE* output) {
  * Parses rest of logical operation and prints out.
  */
 void LogicalOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    unsigned char rd = (instruction >> 9) & 0x7; // Destination register (bits [11:9])
-    unsigned char rs = (instruction >> 6) & 0x7; // Source register (bits [8:6])
-    unsigned char rt;
-    short imm;
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    unsigned char rd = insn->rd; // Destination register (bits [11:9])
+    unsigned char rs = insn->rs; // Source register (bits [8:6])
+    unsigned char rt = insn->rt; // Target register (bits [2:0])
 
-    switch ((instruction >> 3) & 0x7) { // Opcode (bits [5:3])
-        case 0: // AND
-            rt = (instruction >> 0) & 0x7; // Target register (bits [2:0])
+    switch (insn->op) {
+        case OP_AND:
             CPU->R[rd] = CPU->R[rs] & CPU->R[rt];
             break;
-        case 1: // NOT
+        case OP_NOT:
             CPU->R[rd] = ~CPU->R[rs];
             break;
-        case 2: // OR
-            rt = (instruction >> 0) & 0x7; // Target register (bits [2:0])
+        case OP_OR:
             CPU->R[rd] = CPU->R[rs] | CPU->R[rt];
             break;
-        case 3: // XOR
-            rt = (instruction >> 0) & 0x7; // Target register (bits [2:0])
+        case OP_XOR:
             CPU->R[rd] = CPU->R[rs] ^ CPU->R[rt];
             break;
-        default: // AND immediate
-            imm = (short)(instruction & 0x1F); // Immediate 5-bit value (bits [4:0])
-            if ((imm >> 4) & 0x1) {
-                imm |= 0xFFE0;
-            }
-            CPU->R[rd] = CPU->R[rs] & imm;
+        default: // AND immediate, imm5 already sign extended
+            CPU->R[rd] = CPU->R[rs] & insn->imm;
             break;
     }
 
     // Update control signals
     CPU->rsMux_CTL = rs;
-    CPU->rtMux_CTL = (((instruction >> 3) & 0x7) == 4) ? 0 : rt;
+    CPU->rtMux_CTL = (insn->op == OP_ANDI) ? 0 : rt;
     CPU->rdMux_CTL = rd;
     CPU->regFile_WE = 1;
     CPU->NZP_WE = 1;
@@ -613,24 +549,20 @@ void LogicalOp(MachineState* CPU, FILE* output) {
  * Parses rest of jump operation and prints out.
  */
 void JumpOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    short imm = instruction & 0x7FF;
-    if ((imm >> 10) & 0x1) {
-        imm |= 0xF800;
-    }
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    short imm = insn->imm;
     CPU->rsMux_CTL = 0;
     CPU->regFile_WE = 0;
     CPU->NZP_WE = 0;
     CPU->DATA_WE = 0;
     CPU->rdMux_CTL = 0;
     CPU->rtMux_CTL = 0;
-    unsigned short opcode = (instruction >> 11) & 0x1;
-    if (opcode == 1) {
+    if (insn->op == OP_JMP) {
         WriteOut(CPU, output);
         CPU->PC = (CPU->PC & 0x8000) | (imm << 4);
-    } else if (opcode == 0) {
+    } else {
         WriteOut(CPU, output);
-        CPU->PC = INSN_8_6(instruction);
+        CPU->PC = insn->rs;
     }
 }
 
@@ -638,14 +570,10 @@ void JumpOp(MachineState* CPU, FILE* output) {
  * Parses rest of JSR operation and prints out.
  */
 void JSROp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
     //make sure we writeout then update the PC
     unsigned short tempPC;
-    unsigned short opcode = (instruction >> 11) & 0x1;
-    short imm = instruction & 0x7FF;
-    if ((imm >> 10) & 0x1) {
-        imm |= 0xF800;
-    }
+    short imm = insn->imm;
     //save return address
     CPU->R[7] = CPU->PC + 1;
 
@@ -660,10 +588,10 @@ void JSROp(MachineState* CPU, FILE* output) {
     SetNZP(CPU, CPU->R[7]);
 
     WriteOut(CPU, output);
-    if (opcode == 1) {
+    if (insn->op == OP_JSR) {
         tempPC = (CPU->PC & 0x8000) | (imm << 4);
-    } else if (opcode == 0) {
-        tempPC = (instruction >> 6) & 0x7;
+    } else {
+        tempPC = insn->rs;
     }
     CPU->PC = tempPC;
 }
@@ -672,30 +600,34 @@ void JSROp(MachineState* CPU, FILE* output) {
  * Parses rest of shift/mod operations and prints out.
  */
 void ShiftModOp(MachineState* CPU, FILE* output) {
-    unsigned short instruction = CPU->memory[CPU->PC];
-    unsigned short imm = instruction & 0xF;
-    unsigned char rd = (instruction >> 9) & 0x7;
-    unsigned char rs = (instruction >> 6) & 0x7;
+    const DecodedInsn* insn = DecodedAt(CPU, CPU->PC);
+    unsigned short imm = insn->imm;
+    unsigned char rd = insn->rd;
+    unsigned char rs = insn->rs;
 
-    switch ((instruction >> 4) & 0x3) {
-        case 0: {
+    switch (insn->op) {
+        case OP_SLL: {
             //SSL
             CPU->R[rd] = CPU->R[rs] << imm;
             break;
         }
-        case 1: {
+        case OP_SRA: {
             //SRA
             CPU->R[rd] = (short)CPU->R[rs] << imm;
             break;
         }
-        case 2: {
+        case OP_SRL: {
             //SRL
             CPU->R[rd] = CPU->R[rs] >> imm;
             break;
         }
-        case 3: {
+        case OP_MOD: {
             //mod
-            unsigned char rt = instruction & 0x7;
+            unsigned char rt = insn->rt;
+            if (CPU->R[rt] == 0) {
+                CPU->error = 1;
+                return;
+            }
             CPU->R[rd] = CPU->R[rs] % CPU->R[rt];
             break;
         }
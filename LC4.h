@@ -2,9 +2,19 @@
  * LC4.h: Declares simulator functions for executing instructions
  */
 
+#ifndef LC4_H
+#define LC4_H
+
 #include "string.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+struct DecodedInsn;
+
+// Memory is tracked in pages of this many words to know which parts were ever written
+#define MEMORY_PAGE_WORDS 256
+#define MEMORY_PAGE_COUNT (65536 / MEMORY_PAGE_WORDS)
 
 typedef struct {
     // PC the current value of the Program Counter register
@@ -13,6 +23,9 @@ typedef struct {
     // PSR : CPU Status Register, bit[0] = P, bit[1] = Z, bit[2] = N, bit[15] = privilege bit
     unsigned short int PSR;
 
+    // Set when an instruction faults (bad memory access, divide by zero, malformed instruction), cleared by Reset
+    int error;
+
     // Machine registers - all 8
     unsigned short int R[8];
 
@@ -33,11 +46,57 @@ typedef struct {
     unsigned short int dmemAddr;
     unsigned short int dmemValue;
 
+    // One bit per memory page the loader or a store has written to, any nonzero
+    // word is in one of them. Starts out clear (calloc)
+    uint64_t writtenPages[MEMORY_PAGE_COUNT / 64];
+
+    // Same for the pages written since the last checkpoint (see checkpoint.h)
+    uint64_t changedPages[MEMORY_PAGE_COUNT / 64];
+
+    // Predecoded instruction for every address, allocated on first use (see decode.h).
+    // Must start out NULL, so allocate the machine with calloc.
+    struct DecodedInsn* decoded;
+
     // Machine memory - all of it
     unsigned short int memory[65536];
 } MachineState;
 
 
+/*
+ * Record that the word at address is written (call on every store into memory).
+ */
+static inline void MarkWritten(MachineState* CPU, unsigned short address) {
+    int page = address / MEMORY_PAGE_WORDS;
+    CPU->writtenPages[page / 64] |= 1ULL << (page % 64);
+    CPU->changedPages[page / 64] |= 1ULL << (page % 64);
+}
+
+
+/*
+ * Record that count words from address on are written, wrapping at the end of memory.
+ */
+static inline void MarkWrittenRange(MachineState* CPU, unsigned short address, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    int first = address / MEMORY_PAGE_WORDS;
+    size_t pages = (address % MEMORY_PAGE_WORDS + count + MEMORY_PAGE_WORDS - 1) / MEMORY_PAGE_WORDS;
+    for (size_t i = 0; i < pages && i < MEMORY_PAGE_COUNT; i++) {
+        int page = (first + i) % MEMORY_PAGE_COUNT;
+        CPU->writtenPages[page / 64] |= 1ULL << (page % 64);
+        CPU->changedPages[page / 64] |= 1ULL << (page % 64);
+    }
+}
+
+
+/*
+ * Nonzero if the page has been written since the machine was allocated.
+ */
+static inline int PageWritten(const MachineState* CPU, int page) {
+    return (CPU->writtenPages[page / 64] >> (page % 64)) & 1;
+}
+
+
 /*
  * This function should execute one LC4 datapath cycle.
  */
@@ -46,6 +105,7 @@ int UpdateMachineState(MachineState* CPU, FILE* output);
 
 /*
  * This function should write out the current state of the CPU to the file output.
+ * A NULL output means the machine is running without a trace.
  */
 void WriteOut(MachineState* CPU, FILE* output);
 
@@ -108,3 +168,5 @@ void Reset(MachineState* CPU);
  * Clear all of the internal values (set to 0)
  */
 void ClearSignals(MachineState* CPU);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * bintotext.c: converts a binary trace back into the text trace format
+ */
+
+#include "bintrace.h"
+#include "tracewriter.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: %s trace.bin trace.txt\n", argv[0]);
+        return -1;
+    }
+
+    //map the whole binary trace
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening binary trace");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        printf("Error: %s is empty or unreadable\n", argv[1]);
+        return -1;
+    }
+    unsigned char* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("Error mapping binary trace");
+        return -1;
+    }
+    close(fd);
+
+    BinaryTraceReader* reader = malloc(sizeof(BinaryTraceReader));
+    if (reader == NULL || OpenBinaryTrace(reader, data, info.st_size) != 0) {
+        printf("Error: %s is not a binary trace\n", argv[1]);
+        return -1;
+    }
+
+    FILE* output = fopen(argv[2], "w");
+    if (output == NULL) {
+        perror("Error opening output file");
+        return -1;
+    }
+    TraceWriter* trace = CreateTraceWriter(output, TRACE_TEXT, NULL);
+    if (trace == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+
+    //turn every record back into its text line
+    TraceRecord rec;
+    int status;
+    while ((status = ReadBinaryRecord(reader, &rec)) == 1) {
+        TraceEmitRecord(trace, &rec);
+    }
+    if (status < 0) {
+        printf("Warning: %s is truncated, converted up to the damaged record\n", argv[1]);
+    }
+
+    int failed = CloseTraceWriter(trace);
+    if (fclose(output) != 0 || failed) {
+        perror("Error writing output file");
+        return -1;
+    }
+    munmap(data, info.st_size);
+    free(reader);
+    return status < 0 ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * bintrace.c: Defines the compact binary trace format and its reader
+ */
+
+#include "bintrace.h"
+
+//runs of memory are only split on gaps of at least this many zero words
+#define RUN_GAP 8
+
+//longest run, its length is a word and a length of 0 ends the image
+#define RUN_MAX_WORDS 0xFFFF
+
+//helper function to write a little endian word
+static int putWord(FILE* file, unsigned short word) {
+    unsigned char bytes[2] = { word & 0xFF, word >> 8 };
+    return fwrite(bytes, 1, 2, file) == 2 ? 0 : -1;
+}
+
+/*
+ * Write the header with the memory image of CPU, returns 0 on success.
+ */
+int WriteBinaryTraceHeader(FILE* file, const MachineState* CPU) {
+    int failed = fwrite(BINARY_TRACE_MAGIC, 1, 4, file) != 4;
+    failed |= putWord(file, BINARY_TRACE_VERSION);
+
+    //write every stretch of nonzero memory as one run
+    int address = 0;
+    while (address < 65536) {
+        if (CPU->memory[address] == 0) {
+            address++;
+            continue;
+        }
+        //extend the run until a long enough gap of zeros, or as far as one run can go
+        int end = address;
+        int zeros = 0;
+        while (end < 65536 && end - address < RUN_MAX_WORDS && zeros < RUN_GAP) {
+            zeros = CPU->memory[end] ? 0 : zeros + 1;
+            end++;
+        }
+        end -= zeros;
+        failed |= putWord(file, address);
+        failed |= putWord(file, end - address);
+        for (int i = address; i < end; i++) {
+            failed |= putWord(file, CPU->memory[i]);
+        }
+        address = end;
+    }
+    failed |= putWord(file, 0);
+    failed |= putWord(file, 0);
+    return failed ? -1 : 0;
+}
+
+//helper function to read a little endian word, returns -1 past the end
+static int getWord(BinaryTraceReader* reader) {
+    if (reader->size - reader->pos < 2) {
+        return -1;
+    }
+    int word = reader->data[reader->pos] | (reader->data[reader->pos + 1] << 8);
+    reader->pos += 2;
+    return word;
+}
+
+/*
+ * Start reading a binary trace held in memory.
+ */
+int OpenBinaryTrace(BinaryTraceReader* reader, const unsigned char* data, size_t size) {
+    reader->data = data;
+    reader->size = size;
+    reader->pos = 4;
+    reader->lastPC = 0xFFFF;
+    memset(reader->memory, 0, sizeof(reader->memory));
+    if (size < 4 || memcmp(data, BINARY_TRACE_MAGIC, 4) != 0) {
+        return -1;
+    }
+    if (getWord(reader) != BINARY_TRACE_VERSION) {
+        return -1;
+    }
+    //load memory runs until the empty run
+    while (1) {
+        int address = getWord(reader);
+        int count = getWord(reader);
+        if (address < 0 || count < 0 || address + count > 65536) {
+            return -1;
+        }
+        if (count == 0) {
+            return 0;
+        }
+        for (int i = 0; i < count; i++) {
+            int word = getWord(reader);
+            if (word < 0) {
+                return -1;
+            }
+            reader->memory[address + i] = word;
+        }
+    }
+}
+
+/*
+ * Decode the next record.
+ */
+int ReadBinaryRecord(BinaryTraceReader* reader, TraceRecord* rec) {
+    if (reader->pos >= reader->size) {
+        return -1;
+    }
+    unsigned char flags = reader->data[reader->pos++];
+    if (flags == BINARY_TRACE_END) {
+        return 0;
+    }
+
+    rec->PC = reader->lastPC + 1;
+    if (flags & BIN_PC_JUMP) {
+        int delta = getWord(reader);
+        if (delta < 0) {
+            return -1;
+        }
+        rec->PC += delta;
+    }
+    reader->lastPC = rec->PC;
+
+    rec->regFile_WE = (flags & BIN_REG_WE) != 0;
+    rec->rdMux_CTL = 0;
+    rec->regInputVal = 0;
+    if (rec->regFile_WE) {
+        if (reader->pos >= reader->size) {
+            return -1;
+        }
+        rec->rdMux_CTL = reader->data[reader->pos++];
+        int value = getWord(reader);
+        if (value < 0) {
+            return -1;
+        }
+        rec->regInputVal = value;
+    }
+
+    rec->NZP_WE = (flags & BIN_NZP_WE) != 0;
+    rec->NZPVal = (flags >> BIN_NZP_SHIFT) & 0x7;
+
+    rec->DATA_WE = (flags & BIN_DATA_WE) != 0;
+    rec->dmemAddr = 0;
+    rec->dmemValue = 0;
+    if (rec->DATA_WE) {
+        int address = getWord(reader);
+        int value = getWord(reader);
+        if (address < 0 || value < 0) {
+            return -1;
+        }
+        rec->dmemAddr = address;
+        rec->dmemValue = value;
+        //the trace line shows memory after this cycle's store
+        reader->memory[address] = value;
+    }
+
+    rec->instruction = reader->memory[rec->PC];
+    return 1;
+}
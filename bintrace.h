@@ -0,0 +1,106 @@
+/*
+ * bintrace.h: Declares the compact binary trace format and its reader
+ *
+ * A binary trace starts with a header carrying the memory image the program
+ * was loaded into, followed by one variable length record per cycle:
+ *
+ *   header  "LC4B", u16 version, then runs of (u16 address, u16 count,
+ *           count words) ending with a run whose count is 0
+ *   record  u8 flags: bit 0 regFile_WE, bit 1 NZP_WE, bit 2 DATA_WE,
+ *                     bit 3 PC is not the previous PC + 1, bits 4-6 NZPVal
+ *           [u16 PC delta from previous PC + 1]    if bit 3
+ *           [u8 rdMux_CTL, u16 regInputVal]        if regFile_WE
+ *           [u16 dmemAddr, u16 dmemValue]          if DATA_WE
+ *   end     a single BINARY_TRACE_END byte
+ *
+ * All 16 bit values are little endian. The instruction of each cycle is not
+ * stored: readers replay the stores onto the memory image and fetch it from there.
+ */
+
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include "tracefmt.h"
+
+#define BINARY_TRACE_MAGIC "LC4B"
+#define BINARY_TRACE_VERSION 1
+#define BINARY_TRACE_END 0x80
+
+// Longest encoding of one record
+#define BINARY_RECORD_MAX 10
+
+#define BIN_REG_WE 0x01
+#define BIN_NZP_WE 0x02
+#define BIN_DATA_WE 0x04
+#define BIN_PC_JUMP 0x08
+#define BIN_NZP_SHIFT 4
+
+typedef struct {
+    // the trace bytes, e.g. a mapped file
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+
+    // PC of the previous record, the next record's PC defaults to one past it
+    unsigned short lastPC;
+
+    // memory image, kept up to date with the stores in the trace
+    unsigned short memory[65536];
+} BinaryTraceReader;
+
+
+/*
+ * Write the header with the memory image of CPU, returns 0 on success.
+ */
+int WriteBinaryTraceHeader(FILE* file, const MachineState* CPU);
+
+
+/*
+ * Encode one record into dst (room for BINARY_RECORD_MAX bytes), updating
+ * lastPC. Returns the number of bytes written.
+ */
+static inline size_t EncodeBinaryRecord(unsigned char* dst, const TraceRecord* rec, unsigned short* lastPC) {
+    size_t len = 1;
+    unsigned char flags = 0;
+    unsigned short delta = rec->PC - (unsigned short)(*lastPC + 1);
+    if (delta) {
+        flags |= BIN_PC_JUMP;
+        dst[len++] = delta & 0xFF;
+        dst[len++] = delta >> 8;
+    }
+    if (rec->regFile_WE) {
+        flags |= BIN_REG_WE;
+        dst[len++] = rec->rdMux_CTL;
+        dst[len++] = rec->regInputVal & 0xFF;
+        dst[len++] = rec->regInputVal >> 8;
+    }
+    if (rec->NZP_WE) {
+        flags |= BIN_NZP_WE | ((rec->NZPVal & 0x7) << BIN_NZP_SHIFT);
+    }
+    if (rec->DATA_WE) {
+        flags |= BIN_DATA_WE;
+        dst[len++] = rec->dmemAddr & 0xFF;
+        dst[len++] = rec->dmemAddr >> 8;
+        dst[len++] = rec->dmemValue & 0xFF;
+        dst[len++] = rec->dmemValue >> 8;
+    }
+    dst[0] = flags;
+    *lastPC = rec->PC;
+    return len;
+}
+
+
+/*
+ * Start reading a binary trace held in memory: checks the header and loads
+ * the memory image. Returns 0 on success, -1 if the data is not a binary trace.
+ */
+int OpenBinaryTrace(BinaryTraceReader* reader, const unsigned char* data, size_t size);
+
+
+/*
+ * Decode the next record. Returns 1 if rec was filled in, 0 at the end of
+ * the trace and -1 if the trace is truncated or corrupt.
+ */
+int ReadBinaryRecord(BinaryTraceReader* reader, TraceRecord* rec);
+
+#endif
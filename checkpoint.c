@@ -0,0 +1,299 @@
+/*
+ * checkpoint.c: Defines checkpoints of the machine state, saved incrementally
+ */
+
+#include "checkpoint.h"
+#include "decode.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PAGE_ENTRY_SIZE (2 + MEMORY_PAGE_WORDS * 2)
+
+//helper functions to pack and unpack little endian values
+static void putLE(unsigned char* dst, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        dst[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t getLE(const unsigned char* src, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+//helper function to get the length of the complete checkpoint at pos, 0 if there is none
+static size_t recordLength(const unsigned char* data, size_t size, size_t pos) {
+    if (pos + CHECKPOINT_RECORD_SIZE > size || memcmp(data + pos, CHECKPOINT_RECORD_MAGIC, 4) != 0) {
+        return 0;
+    }
+    size_t length = getLE(data + pos + 4, 4);
+    if (length != CHECKPOINT_RECORD_SIZE + getLE(data + pos + 58, 2) * PAGE_ENTRY_SIZE || pos + length > size) {
+        return 0;
+    }
+    return length;
+}
+
+//helper function to cut off a checkpoint a crash left incomplete, so new ones follow the last good one
+static int dropIncomplete(int fd) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        return -1;
+    }
+    if (info.st_size <= CHECKPOINT_HEADER_SIZE) {
+        return ftruncate(fd, 0);
+    }
+    unsigned char* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    size_t pos = CHECKPOINT_HEADER_SIZE;
+    size_t length;
+    while ((length = recordLength(data, info.st_size, pos)) != 0) {
+        pos += length;
+    }
+    munmap(data, info.st_size);
+    return pos < (size_t)info.st_size ? ftruncate(fd, pos) : 0;
+}
+
+/*
+ * Open a checkpoint log for appending (creating it if needed).
+ */
+CheckpointLog* OpenCheckpointLog(const char* filename, uint64_t parent) {
+    CheckpointLog* log = malloc(sizeof(CheckpointLog));
+    if (log == NULL) {
+        return NULL;
+    }
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || dropIncomplete(fd) != 0 || (log->file = fdopen(fd, "ab")) == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(log);
+        return NULL;
+    }
+    log->parent = parent;
+    //a new log starts with its header
+    fseek(log->file, 0, SEEK_END);
+    if (ftell(log->file) == 0) {
+        unsigned char header[CHECKPOINT_HEADER_SIZE] = { 0 };
+        memcpy(header, CHECKPOINT_MAGIC, 4);
+        putLE(header + 4, CHECKPOINT_VERSION, 2);
+        if (fwrite(header, 1, sizeof(header), log->file) != sizeof(header)) {
+            fclose(log->file);
+            free(log);
+            return NULL;
+        }
+    }
+    return log;
+}
+
+/*
+ * Append a checkpoint of CPU taken after cycle cycles.
+ */
+int WriteCheckpoint(CheckpointLog* log, MachineState* CPU, uint64_t cycle) {
+    int pages = 0;
+    for (int i = 0; i < MEMORY_PAGE_COUNT / 64; i++) {
+        pages += __builtin_popcountll(CPU->changedPages[i]);
+    }
+    size_t length = CHECKPOINT_RECORD_SIZE + (size_t)pages * PAGE_ENTRY_SIZE;
+    unsigned char* record = malloc(length);
+    if (record == NULL) {
+        return -1;
+    }
+
+    //registers and signals
+    long offset = ftell(log->file);
+    memcpy(record, CHECKPOINT_RECORD_MAGIC, 4);
+    putLE(record + 4, length, 4);
+    putLE(record + 8, log->parent, 8);
+    putLE(record + 16, cycle, 8);
+    putLE(record + 24, CPU->PC, 2);
+    putLE(record + 26, CPU->PSR, 2);
+    for (int r = 0; r < 8; r++) {
+        putLE(record + 28 + 2 * r, CPU->R[r], 2);
+    }
+    record[44] = CPU->rsMux_CTL;
+    record[45] = CPU->rtMux_CTL;
+    record[46] = CPU->rdMux_CTL;
+    record[47] = CPU->regFile_WE;
+    record[48] = CPU->NZP_WE;
+    record[49] = CPU->DATA_WE;
+    putLE(record + 50, CPU->regInputVal, 2);
+    putLE(record + 52, CPU->NZPVal, 2);
+    putLE(record + 54, CPU->dmemAddr, 2);
+    putLE(record + 56, CPU->dmemValue, 2);
+    putLE(record + 58, pages, 2);
+
+    //the pages written since the last checkpoint
+    unsigned char* dst = record + CHECKPOINT_RECORD_SIZE;
+    for (int page = 0; page < MEMORY_PAGE_COUNT; page++) {
+        if ((CPU->changedPages[page / 64] >> (page % 64)) & 1) {
+            putLE(dst, page, 2);
+            for (int i = 0; i < MEMORY_PAGE_WORDS; i++) {
+                putLE(dst + 2 + 2 * i, CPU->memory[page * MEMORY_PAGE_WORDS + i], 2);
+            }
+            dst += PAGE_ENTRY_SIZE;
+        }
+    }
+
+    //the checkpoint only counts once it is all in the file
+    int failed = offset < 0 || fwrite(record, 1, length, log->file) != length || fflush(log->file) != 0;
+    free(record);
+    if (failed) {
+        return -1;
+    }
+    memset(CPU->changedPages, 0, sizeof(CPU->changedPages));
+    log->parent = offset;
+    return 0;
+}
+
+/*
+ * Close the log, returns 0 if every write succeeded.
+ */
+int CloseCheckpointLog(CheckpointLog* log) {
+    int result = fclose(log->file) != 0 ? -1 : 0;
+    free(log);
+    return result;
+}
+
+//helper function to load the registers, signals and pages of one checkpoint
+static void applyCheckpoint(const unsigned char* record, MachineState* CPU) {
+    CPU->PC = getLE(record + 24, 2);
+    CPU->PSR = getLE(record + 26, 2);
+    for (int r = 0; r < 8; r++) {
+        CPU->R[r] = getLE(record + 28 + 2 * r, 2);
+    }
+    CPU->rsMux_CTL = record[44];
+    CPU->rtMux_CTL = record[45];
+    CPU->rdMux_CTL = record[46];
+    CPU->regFile_WE = record[47];
+    CPU->NZP_WE = record[48];
+    CPU->DATA_WE = record[49];
+    CPU->regInputVal = getLE(record + 50, 2);
+    CPU->NZPVal = getLE(record + 52, 2);
+    CPU->dmemAddr = getLE(record + 54, 2);
+    CPU->dmemValue = getLE(record + 56, 2);
+    int pages = getLE(record + 58, 2);
+    const unsigned char* src = record + CHECKPOINT_RECORD_SIZE;
+    for (int p = 0; p < pages; p++, src += PAGE_ENTRY_SIZE) {
+        int page = getLE(src, 2);
+        for (int i = 0; i < MEMORY_PAGE_WORDS; i++) {
+            CPU->memory[page * MEMORY_PAGE_WORDS + i] = getLE(src + 2 + 2 * i, 2);
+        }
+        MarkWrittenRange(CPU, page * MEMORY_PAGE_WORDS, MEMORY_PAGE_WORDS);
+    }
+}
+
+/*
+ * Restore CPU from the latest checkpoint in the log taken at or before cycle.
+ */
+int RestoreCheckpoint(const char* filename, uint64_t cycle, MachineState* CPU,
+                      uint64_t* restoredCycle, uint64_t* offset) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening checkpoint log");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < CHECKPOINT_HEADER_SIZE) {
+        printf("Error: %s is not a checkpoint log\n", filename);
+        close(fd);
+        return -1;
+    }
+    size_t size = info.st_size;
+    const unsigned char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Error mapping checkpoint log");
+        return -1;
+    }
+    if (memcmp(data, CHECKPOINT_MAGIC, 4) != 0 || getLE(data + 4, 2) != CHECKPOINT_VERSION) {
+        printf("Error: %s is not a checkpoint log\n", filename);
+        munmap((void*)data, size);
+        return -1;
+    }
+
+    //find every complete checkpoint and the latest one at or before the cycle
+    size_t capacity = 64;
+    size_t count = 0;
+    uint64_t* offsets = malloc(capacity * sizeof(uint64_t));
+    size_t chosen = SIZE_MAX;
+    size_t pos = CHECKPOINT_HEADER_SIZE;
+    size_t length;
+    while (offsets && (length = recordLength(data, size, pos)) != 0) {
+        if (count == capacity) {
+            capacity *= 2;
+            uint64_t* bigger = realloc(offsets, capacity * sizeof(uint64_t));
+            if (bigger == NULL) {
+                break;
+            }
+            offsets = bigger;
+        }
+        if (getLE(data + pos + 16, 8) <= cycle) {
+            chosen = count;
+        }
+        offsets[count++] = pos;
+        pos += length;
+    }
+    if (offsets == NULL || chosen == SIZE_MAX) {
+        printf("Error: %s has no checkpoint to restore\n", filename);
+        free(offsets);
+        munmap((void*)data, size);
+        return -1;
+    }
+
+    //walk back to the first checkpoint of the chain; parents always come earlier in the log
+    size_t* chain = malloc(count * sizeof(size_t));
+    size_t chainLength = 0;
+    size_t current = chosen;
+    int broken = chain == NULL;
+    while (!broken) {
+        chain[chainLength++] = current;
+        uint64_t parent = getLE(data + offsets[current] + 8, 8);
+        if (parent == CHECKPOINT_NONE) {
+            break;
+        }
+        //binary search the parent among the earlier checkpoints
+        size_t low = 0;
+        size_t high = current;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (offsets[mid] < parent) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        broken = low == current || offsets[low] != parent;
+        current = low;
+    }
+    if (broken) {
+        printf("Error: %s is damaged\n", filename);
+        free(chain);
+        free(offsets);
+        munmap((void*)data, size);
+        return -1;
+    }
+
+    //rebuild the memory from the first checkpoint on
+    memset(CPU->memory, 0, sizeof(CPU->memory));
+    memset(CPU->writtenPages, 0, sizeof(CPU->writtenPages));
+    for (size_t i = chainLength; i-- > 0;) {
+        applyCheckpoint(data + offsets[chain[i]], CPU);
+    }
+    //the machine now matches the checkpoint, and none of the old decoded code applies
+    memset(CPU->changedPages, 0, sizeof(CPU->changedPages));
+    InvalidateDecodeCache(CPU);
+    *restoredCycle = getLE(data + offsets[chosen] + 16, 8);
+    *offset = offsets[chosen];
+
+    free(chain);
+    free(offsets);
+    munmap((void*)data, size);
+    return 0;
+}
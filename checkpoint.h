@@ -0,0 +1,72 @@
+/*
+ * checkpoint.h: Declares checkpoints of the machine state, saved incrementally
+ *
+ * A checkpoint log holds any number of checkpoints. Each one stores the
+ * registers and control signals in full but only the memory pages written
+ * since the checkpoint it follows (its parent), so restoring one replays its
+ * chain of parents from the first checkpoint on. A log can be extended after
+ * restoring any of its checkpoints; the new checkpoints then branch off there.
+ *
+ *   header      "LC4C", u16 version, u16 0
+ *   checkpoint  "CKPT", u32 length of the whole checkpoint in bytes,
+ *               u64 offset of the parent checkpoint (all ones for none), u64 cycle,
+ *               u16 PC, u16 PSR, u16 R[0..7], u8 rsMux_CTL, rtMux_CTL, rdMux_CTL,
+ *               regFile_WE, NZP_WE, DATA_WE, u16 regInputVal, NZPVal, dmemAddr,
+ *               dmemValue, u16 page count, then per page u16 page number and
+ *               its MEMORY_PAGE_WORDS words
+ *
+ * All values are little endian. A checkpoint cut short by a crash is ignored.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include "LC4.h"
+
+#define CHECKPOINT_MAGIC "LC4C"
+#define CHECKPOINT_RECORD_MAGIC "CKPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_HEADER_SIZE 8
+#define CHECKPOINT_RECORD_SIZE 60
+#define CHECKPOINT_NONE UINT64_MAX
+
+typedef struct {
+    FILE* file;
+
+    // offset of the checkpoint the next one follows
+    uint64_t parent;
+} CheckpointLog;
+
+
+/*
+ * Open a checkpoint log for appending (creating it if needed). The first
+ * checkpoint written follows parent, the offset of the checkpoint the machine
+ * was restored from or CHECKPOINT_NONE. Returns NULL on failure.
+ */
+CheckpointLog* OpenCheckpointLog(const char* filename, uint64_t parent);
+
+
+/*
+ * Append a checkpoint of CPU taken after cycle cycles, holding the pages
+ * written since the previous one, and flush it to the file. Returns 0 on success.
+ */
+int WriteCheckpoint(CheckpointLog* log, MachineState* CPU, uint64_t cycle);
+
+
+/*
+ * Close the log, returns 0 if every write succeeded.
+ */
+int CloseCheckpointLog(CheckpointLog* log);
+
+
+/*
+ * Restore CPU from the latest checkpoint in the log taken at or before cycle
+ * (UINT64_MAX for the latest one). Its cycle and offset are stored in
+ * *restoredCycle and *offset. Returns 0 on success, -1 if the log can't be
+ * read or has no such checkpoint.
+ */
+int RestoreCheckpoint(const char* filename, uint64_t cycle, MachineState* CPU,
+                      uint64_t* restoredCycle, uint64_t* offset);
+
+#endif
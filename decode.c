@@ -0,0 +1,175 @@
+/*
+ * decode.c: Defines the predecode layer that turns LC4 code words into decoded records
+ */
+
+#include "decode.h"
+#include "phases.h"
+
+//macros
+#define INSN_OP(I) ((I) >> 12)
+#define INSN_11_9(I) (((I) >> 9) & 0x7)
+#define INSN_8_6(I) (((I) >> 6) & 0x7) // extracts bits 8:6 for rs
+#define INSN_2_0(I) ((I) & 0x7) // extracts bits 2:0 for rt
+#define SEXT(V, BITS) ((short)((V) << (16 - (BITS))) >> (16 - (BITS))) // sign extends the low BITS bits
+
+static const char* opNames[OP_COUNT] = {
+    "undecoded", "BR", "ADD", "MUL", "SUB", "DIV", "ADDI", "CMP", "CMPU", "CMPI", "CMPIU",
+    "JSRR", "JSR", "AND", "NOT", "OR", "XOR", "ANDI", "LDR", "STR", "RTI", "CONST",
+    "SLL", "SRA", "SRL", "MOD", "JMPR", "JMP", "HICONST", "bad HICONST", "TRAP",
+    "illegal", "halt"
+};
+
+/*
+ * Return the assembler mnemonic of an OP_ id.
+ */
+const char* OpName(int op) {
+    return opNames[op];
+}
+
+/*
+ * Decode a single instruction word into a decoded record.
+ */
+void DecodeInsn(unsigned short instruction, DecodedInsn* insn) {
+    insn->rd = INSN_11_9(instruction);
+    insn->rs = INSN_8_6(instruction);
+    insn->rt = INSN_2_0(instruction);
+    insn->imm = 0;
+    insn->block = 0;
+
+    switch (INSN_OP(instruction)) {
+        case 0: {
+            //branch, rd holds the nzp condition
+            insn->op = OP_BR;
+            insn->imm = SEXT(instruction & 0x1FF, 9);
+            break;
+        }
+        case 1: {
+            if (instruction & 0x0020) {
+                insn->op = OP_ADDI;
+                insn->imm = SEXT(instruction & 0x1F, 5);
+            } else {
+                //bit 5 is clear so bits 5:3 are one of add, mul, sub, div
+                static const unsigned char arith[4] = { OP_ADD, OP_MUL, OP_SUB, OP_DIV };
+                insn->op = arith[(instruction >> 3) & 0x3];
+            }
+            break;
+        }
+        case 2: {
+            //comparisons read rs from bits 11:9
+            static const unsigned char compare[4] = { OP_CMP, OP_CMPU, OP_CMPI, OP_CMPIU };
+            insn->op = compare[(instruction >> 7) & 0x3];
+            insn->rs = INSN_11_9(instruction);
+            if (insn->op == OP_CMPI) {
+                insn->imm = SEXT(instruction & 0x7F, 7);
+            } else if (insn->op == OP_CMPIU) {
+                insn->imm = instruction & 0x7F;
+            }
+            break;
+        }
+        case 4: {
+            insn->op = ((instruction >> 11) & 0x1) ? OP_JSR : OP_JSRR;
+            insn->imm = SEXT(instruction & 0x7FF, 11);
+            break;
+        }
+        case 5: {
+            //bits 5:3 pick the operation, anything from 4 up is AND immediate
+            static const unsigned char logic[4] = { OP_AND, OP_NOT, OP_OR, OP_XOR };
+            unsigned short sub = (instruction >> 3) & 0x7;
+            if (sub < 4) {
+                insn->op = logic[sub];
+            } else {
+                insn->op = OP_ANDI;
+                insn->imm = SEXT(instruction & 0x1F, 5);
+            }
+            break;
+        }
+        case 6: {
+            insn->op = OP_LDR;
+            insn->imm = SEXT(instruction & 0x3F, 6);
+            break;
+        }
+        case 7: {
+            //str reads the value to store from bits 11:9
+            insn->op = OP_STR;
+            insn->rt = INSN_11_9(instruction);
+            insn->imm = SEXT(instruction & 0x3F, 6);
+            break;
+        }
+        case 8: {
+            insn->op = OP_RTI;
+            break;
+        }
+        case 9: {
+            insn->op = OP_CONST;
+            insn->imm = SEXT(instruction & 0x1FF, 9);
+            break;
+        }
+        case 10: {
+            static const unsigned char shift[4] = { OP_SLL, OP_SRA, OP_SRL, OP_MOD };
+            insn->op = shift[(instruction >> 4) & 0x3];
+            insn->imm = instruction & 0xF;
+            break;
+        }
+        case 12: {
+            insn->op = ((instruction >> 11) & 0x1) ? OP_JMP : OP_JMPR;
+            insn->imm = SEXT(instruction & 0x7FF, 11);
+            break;
+        }
+        case 13: {
+            insn->op = ((instruction >> 8) & 0x1) ? OP_HICONST : OP_BADHICONST;
+            insn->imm = instruction & 0xFF;
+            break;
+        }
+        case 15: {
+            insn->op = OP_TRAP;
+            insn->imm = instruction & 0xFF;
+            break;
+        }
+        default: {
+            insn->op = OP_ILLEGAL;
+            break;
+        }
+    }
+}
+
+/*
+ * Decode the word at addr into its cache slot, folding in the PC legality
+ * check: a slot the PC may not execute from decodes to OP_HALT.
+ */
+void DecodeAt(MachineState* CPU, unsigned short addr) {
+    PhaseScope scope = PhaseBegin();
+    DecodedInsn* insn = &CPU->decoded[addr];
+    DecodeInsn(CPU->memory[addr], insn);
+    if (!IsExecutableAddress(addr)) {
+        insn->op = OP_HALT;
+    }
+    PhaseEnd(PHASE_DECODE, scope, 1);
+}
+
+/*
+ * Allocate the per-address decode cache of a machine (all slots undecoded).
+ */
+void AttachDecodeCache(MachineState* CPU) {
+    CPU->decoded = calloc(65536, sizeof(DecodedInsn));
+    if (CPU->decoded == NULL) {
+        perror("Error allocating decode cache");
+        exit(-1);
+    }
+}
+
+/*
+ * Mark every slot of the decode cache as undecoded, e.g. after memory is reloaded.
+ */
+void InvalidateDecodeCache(MachineState* CPU) {
+    if (CPU->decoded) {
+        memset(CPU->decoded, 0, 65536 * sizeof(DecodedInsn));
+    }
+}
+
+/*
+ * Release the decode cache of a machine.
+ */
+void FreeDecodeCache(MachineState* CPU) {
+    free(CPU->decoded);
+    CPU->decoded = NULL;
+}
@@ -0,0 +1,150 @@
+/*
+ * decode.h: Declares the predecode layer that turns LC4 code words into decoded records
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "LC4.h"
+
+// Decoded operation ids, one for every distinct instruction behaviour
+enum {
+    OP_UNDECODED = 0,   // cache slot has not been decoded yet
+    OP_BR,
+    OP_ADD,
+    OP_MUL,
+    OP_SUB,
+    OP_DIV,
+    OP_ADDI,
+    OP_CMP,
+    OP_CMPU,
+    OP_CMPI,
+    OP_CMPIU,
+    OP_JSRR,
+    OP_JSR,
+    OP_AND,
+    OP_NOT,
+    OP_OR,
+    OP_XOR,
+    OP_ANDI,
+    OP_LDR,
+    OP_STR,
+    OP_RTI,
+    OP_CONST,
+    OP_SLL,
+    OP_SRA,
+    OP_SRL,
+    OP_MOD,
+    OP_JMPR,
+    OP_JMP,
+    OP_HICONST,
+    OP_BADHICONST,      // opcode 13 without bit 8 set, faults when executed
+    OP_TRAP,
+    OP_ILLEGAL,         // opcodes 3, 11 and 14, stop the machine
+    OP_HALT,            // the PC may not execute from this address, stop the machine
+    OP_COUNT
+};
+
+typedef struct DecodedInsn {
+    // one of the OP_ ids above
+    unsigned char op;
+
+    // register fields: rd is bits [11:9] (the branch condition for BR),
+    // rs is the first source (bits [11:9] for comparisons, [8:6] otherwise),
+    // rt is the second source (bits [11:9] for STR, [2:0] otherwise)
+    unsigned char rd;
+    unsigned char rs;
+    unsigned char rt;
+
+    // immediate, already sign extended (zero extended for CMPIU, HICONST,
+    // TRAP and the shift amount)
+    short imm;
+
+    // instructions in the basic block starting here, measured by the block
+    // engine the first time it enters at this address (0 until then)
+    unsigned short block;
+} DecodedInsn;
+
+
+/*
+ * Decode a single instruction word into a decoded record.
+ */
+void DecodeInsn(unsigned short instruction, DecodedInsn* insn);
+
+
+/*
+ * Return the assembler mnemonic of an OP_ id.
+ */
+const char* OpName(int op);
+
+
+/*
+ * Return 1 if the PC may fetch from addr, 0 if reaching it stops the machine.
+ */
+static inline int IsExecutableAddress(unsigned short addr) {
+    return addr != 0x80FF && !(addr > 0xA000 && addr < 0xFFFF) && !(addr > 0x2000 && addr < 0x7FFF);
+}
+
+
+/*
+ * Check a data access at memAddress under status register psr the same way
+ * ldrOp/strOp do, returns 1 if it faults.
+ */
+static inline int BadDataAddress(unsigned short psr, unsigned short memAddress) {
+    int isUserMode = (psr >> 15) == 0;
+    int isProtectedAddr = (memAddress < 0xFFFF && memAddress > 0xA000) && isUserMode;
+    int isInvalidAddr = (memAddress < 0x1FFF || (memAddress > 0x8000 && memAddress < 0x9FFF));
+    return isProtectedAddr || isInvalidAddr;
+}
+
+
+/*
+ * Decode the word at addr into its cache slot, folding in the PC legality
+ * check: a slot the PC may not execute from decodes to OP_HALT.
+ */
+void DecodeAt(MachineState* CPU, unsigned short addr);
+
+
+/*
+ * Allocate the per-address decode cache of a machine (all slots undecoded).
+ */
+void AttachDecodeCache(MachineState* CPU);
+
+
+/*
+ * Mark every slot of the decode cache as undecoded, e.g. after memory is reloaded.
+ */
+void InvalidateDecodeCache(MachineState* CPU);
+
+
+/*
+ * Release the decode cache of a machine.
+ */
+void FreeDecodeCache(MachineState* CPU);
+
+
+/*
+ * Drop the decoded record for one address after the word there is rewritten.
+ */
+static inline void InvalidateDecoded(MachineState* CPU, unsigned short addr) {
+    if (CPU->decoded) {
+        CPU->decoded[addr].op = OP_UNDECODED;
+    }
+}
+
+
+/*
+ * Return the decoded record for the word at addr, decoding it on first use.
+ */
+static inline const DecodedInsn* DecodedAt(MachineState* CPU, unsigned short addr) {
+    if (CPU->decoded == NULL) {
+        AttachDecodeCache(CPU);
+    }
+    DecodedInsn* insn = &CPU->decoded[addr];
+    if (insn->op == OP_UNDECODED) {
+        DecodeAt(CPU, addr);
+    }
+    return insn;
+}
+
+#endif
@@ -0,0 +1,424 @@
+/*
+ * engine.c: Defines the execution engines that run many LC4 cycles per call
+ */
+
+#include "engine.h"
+#include "decode.h"
+
+static const char* engineNames[ENGINE_COUNT] = { "switch", "threaded", "block" };
+
+/*
+ * Map an engine name ("switch", "threaded", "block") to its ENGINE_ id, -1 if unknown.
+ */
+int ParseEngineName(const char* name) {
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        if (strcmp(name, engineNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Return the name of an engine.
+ */
+const char* EngineName(int engine) {
+    return engineNames[engine];
+}
+
+/*
+ * Run the machine with the given engine until it halts, faults or has executed
+ * max_cycles instructions, tracing every cycle to trace (NULL for no trace).
+ */
+uint64_t RunMachine(MachineState* CPU, int engine, TraceWriter* trace, uint64_t max_cycles) {
+    //the block engine does not trace, the threaded engine writes the same trace
+    if (engine == ENGINE_THREADED || (engine == ENGINE_BLOCK && trace)) {
+        return RunThreaded(CPU, trace, max_cycles);
+    }
+    if (engine == ENGINE_BLOCK) {
+        return RunBlocks(CPU, max_cycles);
+    }
+    //the switch engine writes each line straight to the file through WriteOut
+    FILE* output = NULL;
+    if (trace) {
+        FlushTraceWriter(trace);
+        output = trace->file;
+    }
+    uint64_t cycles = 0;
+    while (cycles < max_cycles && UpdateMachineState(CPU, output) == 0) {
+        cycles++;
+    }
+    return cycles;
+}
+
+// observation policies the threaded engine is specialized for
+#define POLICY_NONE 0
+#define POLICY_COUNT 1
+#define POLICY_TRACE 2
+#define POLICY_UNDO 3
+#define POLICY_PROFILE 4
+
+// full trace: control signals are kept and every cycle is rendered into the trace writer,
+// matching the LC4.c handlers signal for signal so the trace is identical
+#define ENGINE_FN RunThreadedTrace
+#define ENGINE_POLICY POLICY_TRACE
+#include "threaded_body.h"
+#undef ENGINE_FN
+#undef ENGINE_POLICY
+
+// counters only: executed instructions are tallied per operation
+#define ENGINE_FN RunThreadedCount
+#define ENGINE_POLICY POLICY_COUNT
+#include "threaded_body.h"
+#undef ENGINE_FN
+#undef ENGINE_POLICY
+
+// undo records: each cycle saves what it overwrites before executing
+#define ENGINE_FN RunThreadedUndo
+#define ENGINE_POLICY POLICY_UNDO
+#include "threaded_body.h"
+#undef ENGINE_FN
+#undef ENGINE_POLICY
+
+// profile: per PC, operation and branch counters plus the shadow call stack
+#define ENGINE_FN RunThreadedProfile
+#define ENGINE_POLICY POLICY_PROFILE
+#include "threaded_body.h"
+#undef ENGINE_FN
+#undef ENGINE_POLICY
+
+// nothing observed: just the instruction semantics
+#define ENGINE_FN RunThreadedFast
+#define ENGINE_POLICY POLICY_NONE
+#include "threaded_body.h"
+#undef ENGINE_FN
+#undef ENGINE_POLICY
+
+/*
+ * Direct-threaded engine, picks the trace or no-trace instantiation.
+ */
+uint64_t RunThreaded(MachineState* CPU, TraceWriter* trace, uint64_t max_cycles) {
+    if (trace) {
+        return RunThreadedTrace(CPU, trace, NULL, NULL, NULL, max_cycles);
+    }
+    return RunThreadedFast(CPU, NULL, NULL, NULL, NULL, max_cycles);
+}
+
+/*
+ * Run without tracing, adding the number of executed instructions of each
+ * operation to counts.
+ */
+uint64_t RunCounting(MachineState* CPU, uint64_t counts[], uint64_t max_cycles) {
+    return RunThreadedCount(CPU, NULL, counts, NULL, NULL, max_cycles);
+}
+
+/*
+ * Run without tracing, recording every cycle in the undo log.
+ */
+uint64_t RunRecording(MachineState* CPU, UndoLog* undo, uint64_t max_cycles) {
+    return RunThreadedUndo(CPU, NULL, NULL, undo, NULL, max_cycles);
+}
+
+/*
+ * Run without tracing, counting every cycle in the profile.
+ */
+uint64_t RunProfiling(MachineState* CPU, Profile* profile, uint64_t max_cycles) {
+    return RunThreadedProfile(CPU, NULL, NULL, NULL, profile, max_cycles);
+}
+
+/*
+ * Run the machine to completion without tracing.
+ */
+uint64_t RunUntilHalt(MachineState* CPU, uint64_t max_cycles) {
+    return RunThreadedFast(CPU, NULL, NULL, NULL, NULL, max_cycles);
+}
+
+// Longest basic block the block engine runs between budget checks
+#define BLOCK_MAX_LENGTH 256
+
+// operations that leave the straight line (or stop the machine), ending a basic block
+static const unsigned char endsBlock[OP_COUNT] = {
+    [OP_BR] = 1, [OP_JSRR] = 1, [OP_JSR] = 1, [OP_RTI] = 1, [OP_JMPR] = 1, [OP_JMP] = 1,
+    [OP_TRAP] = 1, [OP_BADHICONST] = 1, [OP_ILLEGAL] = 1, [OP_HALT] = 1,
+};
+
+//helper function to find the length of the basic block entered at entry, decoding it on the way
+static unsigned short measureBlock(MachineState* CPU, unsigned short entry) {
+    unsigned short length = 0;
+    unsigned short pc = entry;
+    while (length < BLOCK_MAX_LENGTH) {
+        const DecodedInsn* insn = DecodedAt(CPU, pc++);
+        length++;
+        if (endsBlock[insn->op]) {
+            break;
+        }
+    }
+    CPU->decoded[entry].block = length;
+    return length;
+}
+
+/*
+ * Basic-block engine: checks the cycle budget and stores the PC and cycle
+ * count once per block instead of once per instruction.
+ */
+uint64_t RunBlocks(MachineState* CPU, uint64_t max_cycles) {
+    static void* const dispatch[OP_COUNT] = {
+        [OP_UNDECODED] = &&do_decode,
+        [OP_BR] = &&do_br,
+        [OP_ADD] = &&do_add,
+        [OP_MUL] = &&do_mul,
+        [OP_SUB] = &&do_sub,
+        [OP_DIV] = &&do_div,
+        [OP_ADDI] = &&do_addi,
+        [OP_CMP] = &&do_cmp,
+        [OP_CMPU] = &&do_cmpu,
+        [OP_CMPI] = &&do_cmpi,
+        [OP_CMPIU] = &&do_cmpiu,
+        [OP_JSRR] = &&do_jsrr,
+        [OP_JSR] = &&do_jsr,
+        [OP_AND] = &&do_and,
+        [OP_NOT] = &&do_not,
+        [OP_OR] = &&do_or,
+        [OP_XOR] = &&do_xor,
+        [OP_ANDI] = &&do_andi,
+        [OP_LDR] = &&do_ldr,
+        [OP_STR] = &&do_str,
+        [OP_RTI] = &&do_rti,
+        [OP_CONST] = &&do_const,
+        [OP_SLL] = &&do_sll,
+        [OP_SRA] = &&do_sra,
+        [OP_SRL] = &&do_srl,
+        [OP_MOD] = &&do_mod,
+        [OP_JMPR] = &&do_jmpr,
+        [OP_JMP] = &&do_jmp,
+        [OP_HICONST] = &&do_hiconst,
+        [OP_BADHICONST] = &&do_fault,
+        [OP_TRAP] = &&do_trap,
+        [OP_ILLEGAL] = &&do_halt,
+        [OP_HALT] = &&do_halt,
+    };
+
+    if (CPU->decoded == NULL) {
+        AttachDecodeCache(CPU);
+    }
+    DecodedInsn* cache = CPU->decoded;
+    unsigned short* R = CPU->R;
+    const DecodedInsn* insn;
+    // cycles of the blocks entered so far, counting the current one whole
+    uint64_t cycles = 0;
+    // the instruction running and how many of the block are left, itself included
+    unsigned short pc;
+    unsigned short left;
+    unsigned short target;
+    int ans;
+
+// run the instruction at pc
+#define DISPATCH() do { \
+        insn = &cache[pc]; \
+        goto *dispatch[insn->op]; \
+    } while (0)
+
+// step to the next instruction of the block, or enter the next block once it is done
+#define NEXT() do { \
+        pc++; \
+        if (--left == 0) { \
+            CPU->PC = pc; \
+            goto enter_block; \
+        } \
+        DISPATCH(); \
+    } while (0)
+
+// leave the block for target: the instructions after this one did not run
+#define JUMP(newPC) do { \
+        target = (newPC); \
+        cycles -= left - 1; \
+        CPU->PC = target; \
+        goto enter_block; \
+    } while (0)
+
+// same result as SetNZP
+#define SET_NZP(result) do { \
+        short nzpResult = (result); \
+        CPU->PSR = (CPU->PSR & 0xFFF8) | ((nzpResult < 0) ? 4 : (nzpResult == 0) ? 2 : 1); \
+    } while (0)
+
+// JSROp and trapOp both save the return address in R7
+#define LINK_R7() do { \
+        R[7] = pc + 1; \
+        SET_NZP(R[7]); \
+    } while (0)
+
+enter_block:
+    //one budget check covers the whole block, a block that does not fit is cut short
+    pc = CPU->PC;
+    left = cache[pc].block ? cache[pc].block : measureBlock(CPU, pc);
+    if (max_cycles - cycles < left) {
+        if (cycles == max_cycles) {
+            return cycles;
+        }
+        left = max_cycles - cycles;
+    }
+    cycles += left;
+    DISPATCH();
+
+do_decode:
+    //rewritten since the block was measured, whatever it is now ends the block if it has to
+    DecodeAt(CPU, pc);
+    goto *dispatch[insn->op];
+
+do_br:
+    JUMP(pc + ((CPU->PSR & insn->rd & 0x7) ? insn->imm + 1 : 1));
+
+do_add:
+    ans = (short)R[insn->rs] + (short)R[insn->rt];
+    goto arith_done;
+
+do_mul:
+    ans = (short)R[insn->rs] * (short)R[insn->rt];
+    goto arith_done;
+
+do_sub:
+    ans = (short)R[insn->rs] - (short)R[insn->rt];
+    goto arith_done;
+
+do_div:
+    if (R[insn->rt] == 0) {
+        goto do_fault;
+    }
+    ans = (short)R[insn->rs] / (short)R[insn->rt];
+    goto arith_done;
+
+do_addi:
+    ans = (short)R[insn->rs] + insn->imm;
+
+arith_done:
+    SET_NZP(ans);
+    R[insn->rd] = ans;
+    NEXT();
+
+do_cmp:
+    SET_NZP((short)R[insn->rs] - (short)R[insn->rt]);
+    NEXT();
+
+do_cmpu:
+    SET_NZP((short)(R[insn->rs] - R[insn->rt]));
+    NEXT();
+
+do_cmpi:
+    SET_NZP((short)R[insn->rs] - insn->imm);
+    NEXT();
+
+do_cmpiu:
+    SET_NZP((short)(R[insn->rs] - (unsigned short)insn->imm));
+    NEXT();
+
+do_jsrr:
+    LINK_R7();
+    JUMP(insn->rs);
+
+do_jsr:
+    LINK_R7();
+    JUMP((pc & 0x8000) | (insn->imm << 4));
+
+do_and:
+    R[insn->rd] = R[insn->rs] & R[insn->rt];
+    goto logic_done;
+
+do_not:
+    R[insn->rd] = ~R[insn->rs];
+    goto logic_done;
+
+do_or:
+    R[insn->rd] = R[insn->rs] | R[insn->rt];
+    goto logic_done;
+
+do_xor:
+    R[insn->rd] = R[insn->rs] ^ R[insn->rt];
+    goto logic_done;
+
+do_andi:
+    R[insn->rd] = R[insn->rs] & insn->imm;
+    goto logic_done;
+
+do_sll:
+    R[insn->rd] = R[insn->rs] << insn->imm;
+    goto logic_done;
+
+do_sra:
+    //ShiftModOp shifts left here as well, kept so every engine agrees
+    R[insn->rd] = (short)R[insn->rs] << insn->imm;
+    goto logic_done;
+
+do_srl:
+    R[insn->rd] = R[insn->rs] >> insn->imm;
+    goto logic_done;
+
+do_mod:
+    if (R[insn->rt] == 0) {
+        goto do_fault;
+    }
+    R[insn->rd] = R[insn->rs] % R[insn->rt];
+    goto logic_done;
+
+do_hiconst:
+    R[insn->rd] = (R[insn->rd] & 0x0FF) | (insn->imm << 8);
+
+logic_done:
+    SET_NZP(R[insn->rd]);
+    NEXT();
+
+do_ldr: {
+    unsigned short memAddress = R[insn->rs] + insn->imm;
+    if (BadDataAddress(CPU->PSR, memAddress) || insn->rs == insn->rd) {
+        goto do_fault;
+    }
+    R[insn->rd] = CPU->memory[memAddress];
+    SET_NZP(R[insn->rd]);
+    NEXT();
+}
+
+do_str: {
+    unsigned short memAddress = R[insn->rs] + insn->imm;
+    if (BadDataAddress(CPU->PSR, memAddress) || insn->rs == insn->rt) {
+        goto do_fault;
+    }
+    //a store into code drops the decoded word, even one later in this block
+    CPU->memory[memAddress] = R[insn->rt];
+    MarkWritten(CPU, memAddress);
+    cache[memAddress].op = OP_UNDECODED;
+    NEXT();
+}
+
+do_rti:
+    JUMP(R[7]);
+
+do_const:
+    R[insn->rd] = insn->imm;
+    SET_NZP(insn->imm);
+    NEXT();
+
+do_jmpr:
+    JUMP(insn->rs);
+
+do_jmp:
+    JUMP((pc & 0x8000) | (insn->imm << 4));
+
+do_trap:
+    LINK_R7();
+    CPU->PSR |= 0x8000;
+    JUMP(0x8000 | insn->imm);
+
+do_fault:
+    CPU->error = 1;
+
+do_halt:
+    //the instruction stopping the machine and the rest of its block did not run
+    CPU->PC = pc;
+    return cycles - left;
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef SET_NZP
+#undef LINK_R7
+}
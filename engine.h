@@ -0,0 +1,96 @@
+/*
+ * engine.h: Declares the execution engines that run many LC4 cycles per call
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include "LC4.h"
+#include "tracewriter.h"
+#include "undo.h"
+#include "profile.h"
+
+// Execution engines selectable at runtime
+enum {
+    ENGINE_SWITCH,      // one UpdateMachineState call per cycle
+    ENGINE_THREADED,    // direct-threaded dispatch over the decode cache
+    ENGINE_BLOCK,       // threaded dispatch with one budget check per basic block
+    ENGINE_COUNT
+};
+
+
+/*
+ * Map an engine name ("switch", "threaded", "block") to its ENGINE_ id, -1 if unknown.
+ */
+int ParseEngineName(const char* name);
+
+
+/*
+ * Return the name of an engine.
+ */
+const char* EngineName(int engine);
+
+
+/*
+ * Run the machine with the given engine until it halts, faults or has executed
+ * max_cycles instructions, tracing every cycle to trace (NULL for no trace).
+ * Returns the number of cycles executed.
+ */
+uint64_t RunMachine(MachineState* CPU, int engine, TraceWriter* trace, uint64_t max_cycles);
+
+
+/*
+ * Run the machine to completion without tracing: the fast path for jobs that
+ * only need the final registers and memory. Stops when the machine halts,
+ * faults (CPU->error is set) or after max_cycles instructions.
+ * Returns the number of cycles executed.
+ */
+uint64_t RunUntilHalt(MachineState* CPU, uint64_t max_cycles);
+
+
+/*
+ * Run without tracing, adding the number of executed instructions of each
+ * operation (indexed by the OP_ ids in decode.h) to counts.
+ * Returns the number of cycles executed.
+ */
+uint64_t RunCounting(MachineState* CPU, uint64_t counts[], uint64_t max_cycles);
+
+
+/*
+ * Run without tracing, recording what every cycle overwrites in the undo log
+ * so the machine can be stepped back afterwards.
+ * Returns the number of cycles executed.
+ */
+uint64_t RunRecording(MachineState* CPU, UndoLog* undo, uint64_t max_cycles);
+
+
+/*
+ * Run without tracing, counting every cycle in the profile: executions per PC
+ * and operation, taken branches and cycles per shadow call stack.
+ * Returns the number of cycles executed.
+ */
+uint64_t RunProfiling(MachineState* CPU, Profile* profile, uint64_t max_cycles);
+
+
+/*
+ * Direct-threaded engine: every handler dispatches straight to the next one
+ * through the decode cache, which also carries the PC legality check.
+ * The handlers are compiled once per observation policy (see threaded_body.h),
+ * a NULL trace selects the copy that neither traces nor keeps control signals.
+ */
+uint64_t RunThreaded(MachineState* CPU, TraceWriter* trace, uint64_t max_cycles);
+
+
+/*
+ * Basic-block engine, without tracing. The first time the PC enters a block
+ * its length is measured up to the next branch, jump, JSR, TRAP, RTI or halt
+ * and kept in the decode cache slot of its first word. Each block then costs
+ * one check of the cycle budget, and the PC and cycle count are written once
+ * when it is left. The PC legality check is already folded into the decode
+ * cache, and a store into code marks the word undecoded, so a block that was
+ * rewritten is decoded again as it runs.
+ */
+uint64_t RunBlocks(MachineState* CPU, uint64_t max_cycles);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * enginecheck.c: Runs generated programs on every engine and checks they all agree
+ *
+ * Each program is generated from its seed: registers start at edge values
+ * (x7FFF, x8000, xFFFF, ...) so comparisons overflow, then come a few hundred
+ * random instructions, a data section and a small trap table. Every program
+ * runs on the switch, threaded and block engines, and all of them run
+ * together as the lanes of one sweep. The registers, flags, fault flag,
+ * cycle count, memory and written pages must come out the same everywhere.
+ * Every program's trace is also rendered through each trace writer (the
+ * switch engine's, the writer thread, the chunk workers and the binary
+ * format turned back into text the way bintotext does) and must match the
+ * threaded engine's byte for byte. Run it with make check.
+ */
+
+#include "engine.h"
+#include "decode.h"
+#include "sweep.h"
+#include "tracewriter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Programs generated when no count is given
+#define CHECK_PROGRAMS 200
+
+// Cycles each program may run
+#define CHECK_MAX_CYCLES 200000
+
+// Cycles of each program that are traced
+#define CHECK_TRACE_CYCLES 20000
+
+// Chunk workers the parallel trace writer renders on
+#define CHECK_TRACE_WORKERS 4
+
+// One way of writing a trace, as trace -e, -a, -j and -b pick it
+typedef struct {
+    const char* name;
+    int engine;
+    int format;
+    int async;
+    int workers;
+} TraceMode;
+
+// The first mode is the reference the others are compared with
+static const TraceMode traceModes[] = {
+    { "threaded", ENGINE_THREADED, TRACE_TEXT, 0, 0 },
+    { "switch", ENGINE_SWITCH, TRACE_TEXT, 0, 0 },
+    { "writer thread", ENGINE_THREADED, TRACE_TEXT, 1, 0 },
+    { "chunk workers", ENGINE_THREADED, TRACE_TEXT, 0, CHECK_TRACE_WORKERS },
+    { "binary", ENGINE_THREADED, TRACE_BINARY, 0, 0 },
+};
+
+#define TRACE_MODE_COUNT (int)(sizeof(traceModes) / sizeof(traceModes[0]))
+
+static uint64_t rngState;
+
+//helper function to draw the next random number (xorshift64*)
+static uint64_t nextRandom(void) {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+//helper function to draw a number below n
+static unsigned randomBelow(unsigned n) {
+    return nextRandom() % n;
+}
+
+//helper function to put count words at address, the way the loader does
+static void place(MachineState* CPU, unsigned short address, const unsigned short* words, int count) {
+    for (int i = 0; i < count; i++) {
+        CPU->memory[(unsigned short)(address + i)] = words[i];
+    }
+    MarkWrittenRange(CPU, address, count);
+}
+
+//helper function to generate one random instruction, weighted towards ones that keep running
+static unsigned short randomInsn(void) {
+    unsigned rd = randomBelow(8), rs = randomBelow(8);
+    unsigned k = randomBelow(100);
+    if (k < 12) return 0x9000 | rd << 9 | randomBelow(512);             // CONST
+    if (k < 18) return 0xD100 | rd << 9 | randomBelow(256);             // HICONST
+    if (k < 30) return 0x1000 | rd << 9 | rs << 6 | randomBelow(64);    // arithmetic
+    if (k < 40) return 0x5000 | rd << 9 | rs << 6 | randomBelow(64);    // logic
+    if (k < 46) return 0x2000 | rd << 9 | randomBelow(512);             // compare
+    if (k < 52) return 0xA000 | rd << 9 | rs << 6 | randomBelow(64);    // shift or mod
+    if (k < 62) return 0x6000 | rd << 9 | rs << 6 | randomBelow(64);    // LDR
+    if (k < 72) return 0x7000 | rd << 9 | rs << 6 | randomBelow(64);    // STR
+    if (k < 84) {
+        //short branches, mostly backwards into loops
+        unsigned offset = randomBelow(2) ? (-(int)(1 + randomBelow(19))) & 0x1FF : randomBelow(20);
+        return rd << 9 | offset;
+    }
+    if (k < 86) return 0xF000 | randomBelow(256);                       // TRAP
+    if (k < 88) return 0x8000;                                          // RTI
+    if (k < 90) return 0xC800 | randomBelow(0x800);                     // JMP
+    if (k < 91) return 0x4800 | randomBelow(0x800);                     // JSR
+    if (k < 92) return 0x4000 | rs << 6;                                // JSRR
+    if (k < 95) return randomBelow(65536);                              // anything, illegal words included
+    return 0x1020 | rd << 9 | rs << 6 | randomBelow(32);                // ADD immediate
+}
+
+//helper function to load the program generated from seed into a reset machine
+static void generateProgram(MachineState* CPU, uint64_t seed) {
+    static const unsigned short edges[] = { 0x4000, 0x4100, 0xC000, 0x2000, 0x7FFF, 0x8000, 0xFFFF, 0xA000 };
+    unsigned short words[512];
+    int count = 0;
+    rngState = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (int reg = 0; reg < 7; reg++) {
+        unsigned short value = edges[randomBelow(8)];
+        words[count++] = 0x9000 | reg << 9 | (value & 0xFF);
+        words[count++] = 0xD100 | reg << 9 | (value >> 8);
+    }
+    for (int i = 20 + randomBelow(280); i > 0; i--) {
+        words[count++] = randomInsn();
+    }
+    place(CPU, 0x8200, words, count);
+
+    count = 1 + randomBelow(299);
+    for (int i = 0; i < count; i++) {
+        words[i] = randomBelow(65536);
+    }
+    place(CPU, 0x4000, words, count);
+
+    if (randomBelow(2)) {
+        count = 1 + randomBelow(99);
+        for (int i = 0; i < count; i++) {
+            words[i] = randomInsn();
+        }
+        place(CPU, 0x0000, words, count);
+    }
+
+    //trap table entries return, fall through or set R7
+    static const unsigned short traps[] = { 0x8000, 0x0000, 0x9E01 };
+    count = 1 + randomBelow(39);
+    for (int i = 0; i < count; i++) {
+        words[i] = traps[randomBelow(3)];
+    }
+    place(CPU, 0x8000, words, count);
+}
+
+//helper function to load a program whose CMP overflows: x7FFF - x8000 wraps to negative,
+//so BRn skips the store and x4000 stays 0 on every engine
+static void loadCompareOverflow(MachineState* CPU) {
+    static const unsigned short jump[] = { 0xC80F };     // JMP x80F0
+    static const unsigned short program[] = {
+        0x90FF, 0xD17F,     // R0 = x7FFF
+        0x9200, 0xD380,     // R1 = x8000
+        0x9400, 0xD540,     // R2 = x4000
+        0x9601,             // R3 = 1
+        0x2001,             // CMP R0, R1
+        0x0801,             // BRn over the store
+        0x7680,             // STR R3, R2, #0
+        0x9800,             // then run into x80FF, which halts
+    };
+    place(CPU, 0x8200, jump, 1);
+    place(CPU, 0x80F0, program, sizeof(program) / sizeof(program[0]));
+}
+
+//helper function to turn a binary trace back into text as bintotext does, returns 0 on success
+static int binaryToText(const char* data, size_t size, FILE* output) {
+    BinaryTraceReader* reader = malloc(sizeof(BinaryTraceReader));
+    TraceWriter* trace = CreateTraceWriter(output, TRACE_TEXT, NULL);
+    int status = -1;
+    if (reader && trace && OpenBinaryTrace(reader, (const unsigned char*)data, size) == 0) {
+        TraceRecord rec;
+        while ((status = ReadBinaryRecord(reader, &rec)) == 1) {
+            TraceEmitRecord(trace, &rec);
+        }
+    }
+    if (trace && CloseTraceWriter(trace) != 0) {
+        status = -1;
+    }
+    free(reader);
+    return status;
+}
+
+//helper function to run a copy of start with its trace written the way mode says, returns the
+//text of the trace (size bytes, to be freed) or NULL if it could not be written
+static char* renderTrace(const MachineState* start, const TraceMode* mode, MachineState* scratch, size_t* size) {
+    char* text = NULL;
+    FILE* file = open_memstream(&text, size);
+    if (file == NULL) {
+        return NULL;
+    }
+    *scratch = *start;
+    TraceWriter* trace = CreateTraceWriter(file, mode->format, scratch);
+    int failed = trace == NULL || (mode->async && StartTraceThread(trace) != 0)
+        || (mode->workers && StartTraceWorkers(trace, mode->workers) != 0);
+    if (!failed) {
+        RunMachine(scratch, mode->engine, trace, CHECK_TRACE_CYCLES);
+    }
+    FreeDecodeCache(scratch);
+    if (trace && CloseTraceWriter(trace) != 0) {
+        failed = 1;
+    }
+    failed |= fclose(file) != 0;
+    if (!failed && mode->format == TRACE_BINARY) {
+        //the binary trace is only compared once it is text again
+        char* binary = text;
+        size_t binarySize = *size;
+        text = NULL;
+        file = open_memstream(&text, size);
+        failed = file == NULL || binaryToText(binary, binarySize, file) != 0;
+        if (file) {
+            failed |= fclose(file) != 0;
+        }
+        free(binary);
+    }
+    if (failed) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+//helper function to compare the trace of every writer against the threaded engine's, returns 1 if any differs
+static int tracesDiffer(const MachineState* start, MachineState* scratch, int program) {
+    size_t referenceSize;
+    char* reference = renderTrace(start, &traceModes[0], scratch, &referenceSize);
+    if (reference == NULL) {
+        printf("program %d: could not write the %s trace\n", program, traceModes[0].name);
+        return 1;
+    }
+    int failed = 0;
+    for (int m = 1; m < TRACE_MODE_COUNT; m++) {
+        size_t size;
+        char* text = renderTrace(start, &traceModes[m], scratch, &size);
+        if (text == NULL) {
+            printf("program %d: could not write the %s trace\n", program, traceModes[m].name);
+            failed = 1;
+            continue;
+        }
+        if (size != referenceSize || memcmp(text, reference, size) != 0) {
+            //name the first line that differs
+            size_t same = 0;
+            while (same < size && same < referenceSize && text[same] == reference[same]) {
+                same++;
+            }
+            printf("program %d: %s trace differs from the threaded one at line %zu\n", program,
+                   traceModes[m].name, same / TRACE_LINE_LENGTH + 1);
+            failed = 1;
+        }
+        free(text);
+    }
+    free(reference);
+    return failed;
+}
+
+//helper function to compare a machine against the reference, returns 1 if they differ
+static int differs(const MachineState* a, uint64_t aCycles, const MachineState* b, uint64_t bCycles) {
+    return aCycles != bCycles || a->PC != b->PC || a->PSR != b->PSR || a->error != b->error
+        || memcmp(a->R, b->R, sizeof(a->R)) != 0 || memcmp(a->memory, b->memory, sizeof(a->memory)) != 0
+        || memcmp(a->writtenPages, b->writtenPages, sizeof(a->writtenPages)) != 0;
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : CHECK_PROGRAMS;
+    if (count < 1) {
+        printf("Usage: %s [programs]\n", argv[0]);
+        return -1;
+    }
+    //lane 0 is the fixed overflow case, the others are generated
+    int lanes = count + 1;
+    MachineState** reference = calloc(lanes, sizeof(MachineState*));
+    MachineState** swept = calloc(lanes, sizeof(MachineState*));
+    MachineState* other = calloc(1, sizeof(MachineState));
+    uint64_t* cycles = calloc(lanes, sizeof(uint64_t));
+    if (reference == NULL || swept == NULL || other == NULL || cycles == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+
+    int failed = 0;
+    for (int l = 0; l < lanes; l++) {
+        reference[l] = calloc(1, sizeof(MachineState));
+        swept[l] = calloc(1, sizeof(MachineState));
+        if (reference[l] == NULL || swept[l] == NULL) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+        Reset(reference[l]);
+        if (l == 0) {
+            loadCompareOverflow(reference[l]);
+        } else {
+            generateProgram(reference[l], l);
+        }
+        //the sweep's copy keeps the starting state until every engine has had it
+        *swept[l] = *reference[l];
+        if (tracesDiffer(swept[l], other, l)) {
+            failed = 1;
+        }
+
+        //the threaded engine is the reference, the others must match it
+        cycles[l] = RunMachine(reference[l], ENGINE_THREADED, NULL, CHECK_MAX_CYCLES);
+        FreeDecodeCache(reference[l]);
+        for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+            if (engine == ENGINE_THREADED) {
+                continue;
+            }
+            *other = *swept[l];
+            uint64_t otherCycles = RunMachine(other, engine, NULL, CHECK_MAX_CYCLES);
+            FreeDecodeCache(other);
+            if (differs(reference[l], cycles[l], other, otherCycles)) {
+                printf("program %d: %s engine stops at x%04X after %llu cycles, threaded at x%04X after %llu\n", l,
+                       EngineName(engine), other->PC, (unsigned long long)otherCycles, reference[l]->PC,
+                       (unsigned long long)cycles[l]);
+                failed = 1;
+            }
+        }
+    }
+    if (reference[0]->memory[0x4000] != 0) {
+        printf("program 0: CMP x7FFF, x8000 did not wrap to negative\n");
+        failed = 1;
+    }
+
+    //and all of them at once on the lockstep engine
+    Sweep* sweep = CreateSweep(swept, lanes);
+    if (sweep == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    RunSweep(sweep, CHECK_MAX_CYCLES);
+    SweepWriteBack(sweep);
+    for (int l = 0; l < lanes; l++) {
+        if (differs(reference[l], cycles[l], swept[l], sweep->cycles[l])) {
+            printf("program %d: sweep stops at x%04X after %llu cycles, threaded at x%04X after %llu\n", l,
+                   swept[l]->PC, (unsigned long long)sweep->cycles[l], reference[l]->PC,
+                   (unsigned long long)cycles[l]);
+            failed = 1;
+        }
+    }
+
+    FreeSweep(sweep);
+    for (int l = 0; l < lanes; l++) {
+        free(reference[l]);
+        free(swept[l]);
+    }
+    free(reference);
+    free(swept);
+    free(other);
+    free(cycles);
+    printf("%d programs on %d engines, %d trace writers and the sweep: %s\n", lanes, ENGINE_COUNT, TRACE_MODE_COUNT,
+           failed ? "MISMATCH" : "all agree");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * imagecache.c: Defines the on-disk cache of loaded memory images
+ */
+
+#include "imagecache.h"
+#include "phases.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+// An obj file mapped for hashing and, on a cache miss, parsing
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    uint64_t hash;
+} MappedObject;
+
+//helper function to fold a 64 bit value into an FNV-1a hash, a byte at a time
+//(xoring in whole words would let the top bits of two words cancel out)
+static inline uint64_t fnvMix(uint64_t hash, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ (value & 0xFF)) * FNV_PRIME;
+        value >>= 8;
+    }
+    return hash;
+}
+
+//helper function to hash a file's size and bytes with FNV-1a
+static uint64_t hashBytes(const unsigned char* data, size_t size) {
+    uint64_t hash = fnvMix(FNV_OFFSET, size);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+//helper function to write a u64 of the image format (little endian)
+static void putU64(unsigned char* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+//helper function to read a u64 of the image format
+static uint64_t getU64(const unsigned char* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+//helper function to map a regular file, returns 0 on success
+static int mapObject(const char* filename, MappedObject* obj) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    obj->size = info.st_size;
+    obj->data = NULL;
+    if (obj->size) {
+        void* data = mmap(NULL, obj->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        obj->data = data;
+    }
+    close(fd);
+    obj->hash = hashBytes(obj->data, obj->size);
+    return 0;
+}
+
+//helper function to build the path of the image for key, returns 0 if it fit
+static int imagePath(char* path, size_t size, const char* dir, uint64_t key, const char* suffix) {
+    int length = snprintf(path, size, "%s/%016llx.img%s", dir, (unsigned long long)key, suffix);
+    return length > 0 && (size_t)length < size ? 0 : -1;
+}
+
+//helper function to restore a cached image of the given obj files, returns 0 if it was found and valid
+static int restoreImage(const char* dir, uint64_t key, const ImageSource* sources, int files, MachineState* CPU) {
+    char path[4096];
+    if (imagePath(path, sizeof(path), dir, key, "") != 0) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t tableSize = (size_t)files * IMAGE_SOURCE_SIZE;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < IMAGE_HEADER_SIZE + tableSize + IMAGE_PAGE_COUNT / 8) {
+        close(fd);
+        return -1;
+    }
+    const unsigned char* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    //check the header and the files it was built from, and that the file holds every page its bitmap announces
+    const unsigned char* bitmap = data + IMAGE_HEADER_SIZE + tableSize;
+    int pages = 0;
+    for (int i = 0; i < IMAGE_PAGE_COUNT / 8; i++) {
+        pages += __builtin_popcount(bitmap[i]);
+    }
+    int sourcesMatch = 1;
+    for (int i = 0; i < files && sourcesMatch; i++) {
+        const unsigned char* entry = data + IMAGE_HEADER_SIZE + (size_t)i * IMAGE_SOURCE_SIZE;
+        sourcesMatch = getU64(entry) == sources[i].size && getU64(entry + 8) == sources[i].hash;
+    }
+    if (memcmp(data, IMAGE_CACHE_MAGIC, 4) != 0 || (data[4] | data[5] << 8) != IMAGE_CACHE_VERSION
+            || (data[6] | data[7] << 8) != files || getU64(data + 8) != key || !sourcesMatch
+            || (size_t)info.st_size != IMAGE_HEADER_SIZE + tableSize + IMAGE_PAGE_COUNT / 8 + (size_t)pages * IMAGE_PAGE_WORDS * 2) {
+        munmap((void*)data, info.st_size);
+        return -1;
+    }
+
+    //copy the pages into place
+    const unsigned char* src = bitmap + IMAGE_PAGE_COUNT / 8;
+    for (int page = 0; page < IMAGE_PAGE_COUNT; page++) {
+        if (bitmap[page / 8] & (1 << (page % 8))) {
+            unsigned short* dst = CPU->memory + page * IMAGE_PAGE_WORDS;
+            MarkWrittenRange(CPU, page * IMAGE_PAGE_WORDS, IMAGE_PAGE_WORDS);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            memcpy(dst, src, IMAGE_PAGE_WORDS * 2);
+#else
+            for (int i = 0; i < IMAGE_PAGE_WORDS; i++) {
+                dst[i] = src[2 * i] | src[2 * i + 1] << 8;
+            }
+#endif
+            src += IMAGE_PAGE_WORDS * 2;
+        }
+    }
+    munmap((void*)data, info.st_size);
+    return 0;
+}
+
+/*
+ * Write the memory of CPU as an image, returns 0 on success.
+ */
+int WriteMemoryImage(FILE* file, const MachineState* CPU, uint64_t key, const ImageSource* sources, int files) {
+    unsigned char header[IMAGE_HEADER_SIZE + IMAGE_PAGE_COUNT / 8] = { 0 };
+    memcpy(header, IMAGE_CACHE_MAGIC, 4);
+    header[4] = IMAGE_CACHE_VERSION & 0xFF;
+    header[5] = IMAGE_CACHE_VERSION >> 8;
+    header[6] = files & 0xFF;
+    header[7] = files >> 8;
+    putU64(header + 8, key);
+    unsigned char* bitmap = header + IMAGE_HEADER_SIZE;
+    static const unsigned short zeroPage[IMAGE_PAGE_WORDS];
+    //pages nothing was ever written to are zero without looking
+    for (int page = 0; page < IMAGE_PAGE_COUNT; page++) {
+        if (PageWritten(CPU, page) && memcmp(CPU->memory + page * IMAGE_PAGE_WORDS, zeroPage, sizeof(zeroPage)) != 0) {
+            bitmap[page / 8] |= 1 << (page % 8);
+        }
+    }
+
+    int failed = fwrite(header, 1, IMAGE_HEADER_SIZE, file) != IMAGE_HEADER_SIZE;
+    for (int i = 0; i < files && !failed; i++) {
+        unsigned char entry[IMAGE_SOURCE_SIZE];
+        putU64(entry, sources[i].size);
+        putU64(entry + 8, sources[i].hash);
+        failed = fwrite(entry, 1, sizeof(entry), file) != sizeof(entry);
+    }
+    if (!failed) {
+        failed = fwrite(bitmap, 1, IMAGE_PAGE_COUNT / 8, file) != IMAGE_PAGE_COUNT / 8;
+    }
+    for (int page = 0; page < IMAGE_PAGE_COUNT && !failed; page++) {
+        if (bitmap[page / 8] & (1 << (page % 8))) {
+            unsigned char bytes[IMAGE_PAGE_WORDS * 2];
+            for (int i = 0; i < IMAGE_PAGE_WORDS; i++) {
+                unsigned short word = CPU->memory[page * IMAGE_PAGE_WORDS + i];
+                bytes[2 * i] = word & 0xFF;
+                bytes[2 * i + 1] = word >> 8;
+            }
+            failed = fwrite(bytes, 1, sizeof(bytes), file) != sizeof(bytes);
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+//helper function to save the current memory image under key, written to a
+//temporary file first so concurrent runs never see a partial image
+static void saveImage(const char* dir, uint64_t key, const ImageSource* sources, int files, const MachineState* CPU) {
+    char path[4096], tempPath[4096], suffix[32];
+    //unique per process and per save, jobs of one process may save at the same time
+    static _Atomic unsigned saves;
+    snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", (int)getpid(), atomic_fetch_add(&saves, 1));
+    if (imagePath(path, sizeof(path), dir, key, "") != 0 || imagePath(tempPath, sizeof(tempPath), dir, key, suffix) != 0) {
+        return;
+    }
+    FILE* file = fopen(tempPath, "wb");
+    if (file == NULL) {
+        return;
+    }
+    int failed = WriteMemoryImage(file, CPU, key, sources, files);
+    if (fclose(file) != 0 || failed || rename(tempPath, path) != 0) {
+        remove(tempPath);
+    }
+}
+
+/*
+ * Load the obj files in order, going through the image cache in dir.
+ */
+int LoadObjectsCached(const char* dir, char** files, int count, MachineState* CPU, SymbolTable* symbols,
+                      LoadMap* loads) {
+    //the cacheable files: all but the last, up to the first one that is not a regular file
+    int cacheable = 0;
+    MappedObject* objs = calloc(count, sizeof(MappedObject));
+    if (objs == NULL) {
+        return -1;
+    }
+    PhaseScope scope = PhaseBegin();
+    while (cacheable < count - 1 && strcmp(files[cacheable], "-") != 0
+            && mapObject(files[cacheable], &objs[cacheable]) == 0) {
+        cacheable++;
+    }
+
+    //keys[k] covers the first k files, so a run with more files after them still hits
+    uint64_t* keys = malloc((cacheable + 1) * sizeof(uint64_t));
+    ImageSource* sources = malloc((cacheable + 1) * sizeof(ImageSource));
+    if (keys == NULL || sources == NULL) {
+        free(keys);
+        free(sources);
+        free(objs);
+        return -1;
+    }
+    keys[0] = FNV_OFFSET;
+    for (int i = 0; i < cacheable; i++) {
+        sources[i] = (ImageSource){ objs[i].size, objs[i].hash };
+        keys[i + 1] = fnvMix(fnvMix(keys[i], objs[i].size), objs[i].hash);
+    }
+
+    //restore the longest cached prefix
+    int restored = cacheable;
+    while (restored > 0 && restoreImage(dir, keys[restored], sources, restored, CPU) != 0) {
+        restored--;
+    }
+
+    //parse the cacheable files from their mappings and copy in the ones not restored; all of
+    //them go in the load map, so overlaps are reported the same whether or not they were cached
+    LoadMap own = { 0 };
+    LoadMap* map = loads ? loads : &own;
+    int result = 0;
+    for (int i = 0; i < cacheable && result == 0; i++) {
+        ObjectSections list = { 0 };
+        PhaseScope parseScope = PhaseBegin();
+        result = ParseObjectSections(objs[i].data, objs[i].size, &list);
+        PhaseEnd(PHASE_PARSE, parseScope, objs[i].size);
+        if (result != 0) {
+            printf("Error loading file %s\n", files[i]);
+        } else {
+            if (i >= restored) {
+                ApplyObjectSections(&list, CPU);
+            }
+            result = AddToLoadMap(map, files[i], &list);
+        }
+        free(list.sections);
+    }
+    //images hold no debug sections, take those of every cacheable file from its mapping
+    PhaseScope symbolScope = PhaseBegin();
+    for (int i = 0; i < cacheable && result == 0 && symbols; i++) {
+        result = ParseObjectSymbols(objs[i].data, objs[i].size, symbols);
+    }
+    PhaseEnd(PHASE_SYMBOLS, symbolScope, 0);
+    if (result == 0 && restored < cacheable) {
+        saveImage(dir, keys[cacheable], sources, cacheable, CPU);
+    }
+
+    for (int i = 0; i < cacheable; i++) {
+        if (objs[i].data) {
+            munmap((void*)objs[i].data, objs[i].size);
+        }
+    }
+    free(objs);
+    free(keys);
+    free(sources);
+
+    //the program itself and anything that could not be mapped go through the loader
+    if (result == 0 && LoadObjectFiles(files + cacheable, count - cacheable, CPU, symbols, map) != 0) {
+        result = -1;
+    }
+    if (result == 0 && loads == NULL) {
+        ReportLoadOverlaps(&own, 0, NULL);
+    }
+    FreeLoadMap(&own);
+    PhaseEnd(PHASE_CACHE, scope, restored);
+    return result;
+}
@@ -0,0 +1,61 @@
+/*
+ * imagecache.h: Declares the on-disk cache of loaded memory images
+ *
+ * Runs that load the same obj files ahead of a small program can restore the
+ * memory those files produce instead of parsing them again. Images are keyed
+ * by the content of the obj files that built them, in load order, and stored
+ * in <cache dir>/<key>.img as:
+ *
+ *   header  "LC4M", u16 version, u16 number of obj files, u64 key
+ *   files   u64 size and u64 content hash of each obj file, in load order
+ *   bitmap  one bit per 256 word page that holds a nonzero word (32 bytes)
+ *   pages   the 256 words of every page in the bitmap, in address order
+ *
+ * Words and u64s are little endian. A hit needs the key and every file's
+ * size and hash to match. The same format serves as a binary memory dump
+ * (trace -B), with a key and file count of 0.
+ */
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <stdint.h>
+#include "LC4.h"
+#include "symbols.h"
+#include "loader.h"
+
+#define IMAGE_CACHE_MAGIC "LC4M"
+#define IMAGE_CACHE_VERSION 2
+#define IMAGE_PAGE_WORDS MEMORY_PAGE_WORDS
+#define IMAGE_PAGE_COUNT MEMORY_PAGE_COUNT
+#define IMAGE_HEADER_SIZE 16
+#define IMAGE_SOURCE_SIZE 16
+
+// What the image records about each obj file that built it
+typedef struct {
+    uint64_t size;
+    uint64_t hash;
+} ImageSource;
+
+
+/*
+ * Load the obj files in order into a freshly reset CPU, going through the
+ * image cache in dir. All files but the last (the program being run) can come
+ * from the cache: the longest cached run of them is restored, the others are
+ * parsed, and the image of all of them is saved if it was not cached yet.
+ * The file "-" (standard input) and everything after it is always parsed.
+ * Returns 0 on success, -1 if a file could not be loaded (a broken cache
+ * only costs a reparse). Labels and line numbers go to symbols and the files
+ * to loads as with LoadObjectFiles, restored files included.
+ */
+int LoadObjectsCached(const char* dir, char** files, int count, MachineState* CPU, SymbolTable* symbols,
+                      LoadMap* loads);
+
+
+/*
+ * Write the memory of CPU as an image (only pages holding a nonzero word),
+ * recording the obj files it was built from, returns 0 on success.
+ */
+int WriteMemoryImage(FILE* file, const MachineState* CPU, uint64_t key, const ImageSource* sources, int files);
+
+#endif
@@ -0,0 +1,662 @@
+/*
+ * job.c: Defines simulation jobs, parsed from trace style arguments and run on a machine of their own
+ */
+
+#include "job.h"
+#include "decode.h"
+#include "engine.h"
+#include "imagecache.h"
+#include "memdump.h"
+#include "checkpoint.h"
+#include "phases.h"
+#include <time.h>
+#include <unistd.h>
+
+//helper function to output memory contents to the job's stream or file, as text lines or a binary image
+static int outputMemory(const SimJob* job, MachineState* CPU) {
+    //try to open file and if we can't return with an error code
+    FILE* outputFile = job->outputStream ? job->outputStream : fopen(job->outputFilename, job->binaryDump ? "wb" : "w");
+    if (outputFile == NULL) {
+        perror("Error opening output file");
+        return -1;
+    }
+    //only the written pages are scanned for nonzero words
+    int failed = job->binaryDump ? WriteMemoryImage(outputFile, CPU, 0, NULL, 0) : WriteMemoryDump(outputFile, CPU);
+    failed |= job->outputStream ? fflush(outputFile) != 0 : fclose(outputFile) != 0;
+    if (failed) {
+        perror("Error writing output file");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Print how to write a job's arguments.
+ */
+void PrintJobUsage(const char* name) {
+    printf("Usage: %s [-e switch|threaded|block] [-t trace.txt [-b] [-a | -j workers] [-i interval] | -r] [-c max_cycles] [-s] [-n] [-m cache_dir] [-B] [-k log [-K interval]] [-R log[:cycle]] [-u history [-x back:N|pc:XXXX]] [-p report.txt] [-T phases.json] output_filename.txt first.obj [second.obj ...]\n", name);
+    printf("  an obj file named - is read from standard input\n");
+    printf("  -e  execution engine (default threaded)\n");
+    printf("  -t  run the loaded program, writing the cycle trace to this file\n");
+    printf("  -b  write the trace in the compact binary format (convert it with bintotext)\n");
+    printf("  -a  render and write the trace on a separate writer thread\n");
+    printf("  -j  render the trace in chunks on this many worker threads\n");
+    printf("  -i  write trace.txt.idx, indexing every interval cycles (see tracequery)\n");
+    printf("  -r  run the loaded program without a trace\n");
+    printf("  -c  stop after this many cycles\n");
+    printf("  -s  print cycle count and MIPS to stderr after running\n");
+    printf("  -n  count executed instructions per operation and print them to stderr (no trace)\n");
+    printf("  -B  write the memory dump as a binary image (format in imagecache.h)\n");
+    printf("  -k  append a checkpoint of the machine to this log when the run stops\n");
+    printf("  -K  also checkpoint every interval cycles\n");
+    printf("  -R  start from the latest checkpoint in this log (at or before cycle), obj files load on top\n");
+    printf("  -u  run without a trace, keeping the last history cycles so the machine can be stepped back\n");
+    printf("  -x  when the run stops, step back N cycles or to before the last execution of PC XXXX (hex)\n");
+    printf("  -p  profile the run without a trace, writing a report and report.folded call stacks\n");
+    printf("  -T  time the phases of the run, printing a summary and writing them as JSON\n");
+    printf("  -m  reuse the memory image of all but the last obj file from this cache directory\n");
+}
+
+/*
+ * Split line into arguments after name.
+ */
+int SplitJobArgs(char* line, const char* name, char*** argv) {
+    int capacity = 8;
+    int argc = 0;
+    *argv = malloc(capacity * sizeof(char*));
+    if (*argv == NULL) {
+        return -1;
+    }
+    (*argv)[argc++] = (char*)name;
+    char* rest;
+    for (char* arg = strtok_r(line, " \t\r\n", &rest); arg; arg = strtok_r(NULL, " \t\r\n", &rest)) {
+        //keep room for the NULL getopt expects at argv[argc]
+        if (argc + 1 == capacity) {
+            capacity *= 2;
+            char** bigger = realloc(*argv, capacity * sizeof(char*));
+            if (bigger == NULL) {
+                return -1;
+            }
+            *argv = bigger;
+        }
+        (*argv)[argc++] = arg;
+    }
+    (*argv)[argc] = NULL;
+    return argc;
+}
+
+/*
+ * Fill in job from trace style arguments.
+ */
+int ParseJobArgs(int argc, char** argv, int preloaded, SimJob* job) {
+    *job = (SimJob){
+        .engine = ENGINE_THREADED,
+        .traceFormat = TRACE_TEXT,
+        .maxCycles = UINT64_MAX,
+        .restoreCycle = UINT64_MAX,
+    };
+
+    //parse options, from the start: getopt may have parsed another job's arguments before
+    int opt;
+    optind = 0;
+    while ((opt = getopt(argc, argv, "e:t:baj:i:rc:snm:Bk:K:R:u:x:p:T:")) != -1) {
+        switch (opt) {
+            case 'e': {
+                job->engine = ParseEngineName(optarg);
+                if (job->engine < 0) {
+                    printf("Error: unknown engine %s\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+            case 't': {
+                job->traceFilename = optarg;
+                job->runProgram = 1;
+                break;
+            }
+            case 'b': {
+                job->traceFormat = TRACE_BINARY;
+                break;
+            }
+            case 'a': {
+                job->asyncTrace = 1;
+                break;
+            }
+            case 'j': {
+                job->traceWorkers = atoi(optarg);
+                if (job->traceWorkers < 1 || job->traceWorkers > TRACE_POOL_MAX_WORKERS) {
+                    printf("Error: -j takes 1 to %d workers\n", TRACE_POOL_MAX_WORKERS);
+                    return -1;
+                }
+                break;
+            }
+            case 'i': {
+                unsigned long interval = strtoul(optarg, NULL, 0);
+                if (interval < 1 || interval > UINT32_MAX) {
+                    printf("Error: -i takes an interval of at least 1 cycle\n");
+                    return -1;
+                }
+                job->indexInterval = interval;
+                break;
+            }
+            case 'r': {
+                job->runProgram = 1;
+                break;
+            }
+            case 'c': {
+                job->maxCycles = strtoull(optarg, NULL, 0);
+                break;
+            }
+            case 's': {
+                job->printStats = 1;
+                break;
+            }
+            case 'n': {
+                job->countOps = 1;
+                job->runProgram = 1;
+                break;
+            }
+            case 'm': {
+                job->cacheDir = optarg;
+                break;
+            }
+            case 'B': {
+                job->binaryDump = 1;
+                break;
+            }
+            case 'k': {
+                job->checkpointFilename = optarg;
+                job->runProgram = 1;
+                break;
+            }
+            case 'K': {
+                job->checkpointInterval = strtoull(optarg, NULL, 0);
+                if (job->checkpointInterval == 0) {
+                    printf("Error: -K takes an interval of at least 1 cycle\n");
+                    return -1;
+                }
+                break;
+            }
+            case 'u': {
+                job->undoHistory = strtoull(optarg, NULL, 0);
+                job->runProgram = 1;
+                if (job->undoHistory == 0 || job->undoHistory > UNDO_MAX_HISTORY) {
+                    printf("Error: -u takes a history of 1 to %llu cycles\n", (unsigned long long)UNDO_MAX_HISTORY);
+                    return -1;
+                }
+                break;
+            }
+            case 'x': {
+                job->rewindSpec = optarg;
+                if (strncmp(job->rewindSpec, "back:", 5) != 0 && strncmp(job->rewindSpec, "pc:", 3) != 0) {
+                    printf("Error: -x takes back:N or pc:XXXX\n");
+                    return -1;
+                }
+                break;
+            }
+            case 'T': {
+                job->phasesFilename = optarg;
+                break;
+            }
+            case 'p': {
+                job->profileFilename = optarg;
+                job->runProgram = 1;
+                break;
+            }
+            case 'R': {
+                //an optional :cycle picks an older checkpoint
+                job->restoreFilename = optarg;
+                char* colon = strrchr(optarg, ':');
+                if (colon && colon[1] && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+                    *colon = '\0';
+                    job->restoreCycle = strtoull(colon + 1, NULL, 10);
+                }
+                break;
+            }
+            default: {
+                PrintJobUsage(argv[0]);
+                return -1;
+            }
+        }
+    }
+    //the output file and obj files follow the options
+    //make sure we're receiving at least one output file and obj file (a restored checkpoint or preloaded image needs none)
+    if (argc - optind < (job->restoreFilename || preloaded ? 1 : 2)) {
+        PrintJobUsage(argv[0]);
+        return -1;
+    }
+    job->outputFilename = argv[optind];
+    job->objFiles = argv + optind + 1;
+    job->objCount = argc - optind - 1;
+
+    //recording undo information is its own engine instantiation too
+    if (job->undoHistory && (job->traceFilename || job->countOps || job->engine != ENGINE_THREADED)) {
+        printf("Error: -u runs the threaded engine without a trace and cannot be combined with -t or -n\n");
+        return -1;
+    }
+    //so is profiling
+    if (job->profileFilename && (job->traceFilename || job->countOps || job->undoHistory || job->engine != ENGINE_THREADED)) {
+        printf("Error: -p runs the threaded engine without a trace and cannot be combined with -t, -n or -u\n");
+        return -1;
+    }
+    if (job->rewindSpec && !job->undoHistory) {
+        printf("Error: -x needs an undo history (-u)\n");
+        return -1;
+    }
+    if (job->checkpointInterval && !job->checkpointFilename) {
+        printf("Error: -K needs a checkpoint log (-k)\n");
+        return -1;
+    }
+    //cached images are keyed by their obj files alone and hold a freshly reset machine
+    if (job->restoreFilename && job->cacheDir) {
+        printf("Error: -R cannot be combined with -m\n");
+        return -1;
+    }
+
+    //counting runs its own engine instantiation, which does not trace
+    if (job->countOps && job->traceFilename) {
+        printf("Error: -n cannot be combined with -t\n");
+        return -1;
+    }
+
+    //the block engine only runs without a trace
+    if (job->engine == ENGINE_BLOCK && (job->traceFilename || job->countOps)) {
+        printf("Error: the block engine runs without a trace and cannot be combined with -t or -n\n");
+        return -1;
+    }
+
+    //only the threaded engine can feed the binary format and the writer threads
+    if ((job->traceFormat == TRACE_BINARY || job->asyncTrace || job->traceWorkers || job->indexInterval) && job->engine == ENGINE_SWITCH) {
+        printf("Error: binary, asynchronous, parallel and indexed traces need the threaded engine\n");
+        return -1;
+    }
+    if (job->indexInterval && !job->traceFilename) {
+        printf("Error: -i needs a trace file\n");
+        return -1;
+    }
+    if (job->asyncTrace && job->traceWorkers) {
+        printf("Error: -a and -j cannot be combined\n");
+        return -1;
+    }
+    return 0;
+}
+
+//helper function to start a message on stderr with the job's label, if it has one
+static void printLabel(const SimJob* job) {
+    if (job->label) {
+        fprintf(stderr, "%s: ", job->label);
+    }
+}
+
+//helper function to say where the program faulted, by label and source line when the obj files had them
+static void reportFault(const SimJob* job, const MachineState* CPU, const SymbolTable* symbols, uint64_t cycle) {
+    char name[64];
+    const char* file = NULL;
+    uint16_t offset;
+    int line = FindLine(symbols, CPU->PC, &file);
+    printLabel(job);
+    fprintf(stderr, "Error: fault at %s", FormatAddress(symbols, CPU->PC, name, sizeof(name)));
+    if (FindSymbol(symbols, CPU->PC, &offset)) {
+        fprintf(stderr, " (x%04X)", CPU->PC);
+    }
+    if (line) {
+        fprintf(stderr, " %s:%d", file ? file : "?", line);
+    }
+    fprintf(stderr, " after %llu cycles\n", (unsigned long long)cycle);
+}
+
+//helper function to step the stopped machine back as the -x spec says, returns the cycles undone
+static uint64_t rewindMachine(const SimJob* job, MachineState* CPU, UndoLog* undo, uint64_t cycle) {
+    uint64_t rewound;
+    if (strncmp(job->rewindSpec, "back:", 5) == 0) {
+        uint64_t steps = strtoull(job->rewindSpec + 5, NULL, 0);
+        rewound = StepBack(undo, CPU, steps);
+        if (rewound < steps) {
+            printLabel(job);
+            fprintf(stderr, "Warning: only %llu cycles of history, restore an earlier checkpoint to go further\n",
+                    (unsigned long long)rewound);
+        }
+    } else {
+        rewound = RunBackTo(undo, CPU, strtoul(job->rewindSpec + 3, NULL, 16));
+        if (rewound == 0) {
+            printLabel(job);
+            fprintf(stderr, "Warning: PC %s was not executed in the last %llu cycles\n", job->rewindSpec + 3,
+                    (unsigned long long)undo->depth);
+        }
+    }
+    printLabel(job);
+    fprintf(stderr, "stepped back %llu cycles to cycle %llu: PC=%04X PSR=%04X", (unsigned long long)rewound,
+            (unsigned long long)(cycle - rewound), CPU->PC, CPU->PSR);
+    for (int r = 0; r < 8; r++) {
+        fprintf(stderr, " R%d=%04X", r, CPU->R[r]);
+    }
+    fprintf(stderr, "\n");
+    return rewound;
+}
+
+//helper function to write the profile report and its folded stacks, returns 0 on success
+static int writeProfileFiles(const SimJob* job, const Profile* profile, const SymbolTable* symbols) {
+    //the folded stacks sit next to the report, under the same name plus .folded
+    char* foldedFilename = malloc(strlen(job->profileFilename) + 8);
+    if (foldedFilename == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    sprintf(foldedFilename, "%s.folded", job->profileFilename);
+    FILE* reportFile = fopen(job->profileFilename, "w");
+    FILE* foldedFile = fopen(foldedFilename, "w");
+    free(foldedFilename);
+    if (reportFile == NULL || foldedFile == NULL) {
+        perror("Error opening profile");
+        if (reportFile) {
+            fclose(reportFile);
+        }
+        if (foldedFile) {
+            fclose(foldedFile);
+        }
+        return -1;
+    }
+    int failed = WriteProfile(profile, symbols, reportFile, foldedFile);
+    failed |= fclose(reportFile) != 0;
+    failed |= fclose(foldedFile) != 0;
+    if (failed) {
+        perror("Error writing profile");
+        return -1;
+    }
+    return 0;
+}
+
+//helper function to run the loaded machine with the trace, checkpoints, undo history and
+//profile the job asks for, setting stopCycle to the cycle it stopped at, returns 0 on success
+static int runLoaded(const SimJob* job, MachineState* CPU, const SymbolTable* symbols, uint64_t startCycle,
+                     uint64_t restoredOffset, uint64_t* stopCycle) {
+    int result = -1;
+    FILE* traceFile = NULL;
+    FILE* indexFile = NULL;
+    TraceWriter* trace = NULL;
+    CheckpointLog* checkpoints = NULL;
+    UndoLog* undo = NULL;
+    Profile* profile = NULL;
+    PhaseScope scope;
+
+    if (job->traceFilename) {
+        traceFile = job->traceStream ? job->traceStream : fopen(job->traceFilename, job->traceFormat == TRACE_BINARY ? "wb" : "w");
+        if (traceFile == NULL) {
+            perror("Error opening trace file");
+            goto done;
+        }
+        trace = CreateTraceWriter(traceFile, job->traceFormat, CPU);
+        if (trace && job->indexInterval) {
+            //the index sits next to the trace, under the same name plus .idx
+            char* indexFilename = malloc(strlen(job->traceFilename) + 5);
+            if (indexFilename) {
+                sprintf(indexFilename, "%s.idx", job->traceFilename);
+                indexFile = fopen(indexFilename, "wb");
+                free(indexFilename);
+            }
+            if (indexFile == NULL) {
+                perror("Error opening index file");
+                goto done;
+            }
+            if (StartTraceIndex(trace, indexFile, job->indexInterval) != 0) {
+                printf("Error: could not index the trace (is it a regular file?)\n");
+                goto done;
+            }
+        }
+        if (trace == NULL || (job->asyncTrace && StartTraceThread(trace) != 0)
+                || (job->traceWorkers && StartTraceWorkers(trace, job->traceWorkers) != 0)) {
+            printf("Error: could not start the trace\n");
+            goto done;
+        }
+    }
+    if (job->checkpointFilename) {
+        //continuing the log the machine came from only needs the pages changed since;
+        //anywhere else the first checkpoint has to hold all of memory
+        int sameLog = job->restoreFilename && strcmp(job->restoreFilename, job->checkpointFilename) == 0;
+        if (!sameLog) {
+            memcpy(CPU->changedPages, CPU->writtenPages, sizeof(CPU->changedPages));
+        }
+        checkpoints = OpenCheckpointLog(job->checkpointFilename, sameLog ? restoredOffset : CHECKPOINT_NONE);
+        if (checkpoints == NULL) {
+            perror("Error opening checkpoint log");
+            goto done;
+        }
+    }
+    if (job->undoHistory && (undo = CreateUndoLog(job->undoHistory)) == NULL) {
+        printf("Error: out of memory for the undo history\n");
+        goto done;
+    }
+    //the root of the shadow call stack is wherever the run starts
+    if (job->profileFilename && (profile = CreateProfile(CPU->PC)) == NULL) {
+        printf("Error: out of memory for the profile\n");
+        goto done;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t opCounts[OP_COUNT] = { 0 };
+    uint64_t cycles = 0;
+    uint64_t checkpointCycle = UINT64_MAX;
+    //run in slices between checkpoints, until the program halts or the cycle limit is hit
+    while (1) {
+        uint64_t slice = job->maxCycles - cycles;
+        if (job->checkpointInterval && slice > job->checkpointInterval) {
+            slice = job->checkpointInterval;
+        }
+        scope = PhaseBegin();
+        uint64_t ran = job->countOps ? RunCounting(CPU, opCounts, slice)
+                     : profile ? RunProfiling(CPU, profile, slice)
+                     : undo ? RunRecording(CPU, undo, slice) : RunMachine(CPU, job->engine, trace, slice);
+        PhaseEnd(PHASE_EXECUTE, scope, ran);
+        cycles += ran;
+        if (ran < slice || cycles == job->maxCycles) {
+            break;
+        }
+        scope = PhaseBegin();
+        if (WriteCheckpoint(checkpoints, CPU, startCycle + cycles) != 0) {
+            perror("Error writing checkpoint");
+            goto done;
+        }
+        PhaseEnd(PHASE_CHECKPOINT, scope, 1);
+        checkpointCycle = cycles;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (CPU->error) {
+        reportFault(job, CPU, symbols, startCycle + cycles);
+    }
+
+    //travel back from where the run stopped
+    uint64_t rewound = job->rewindSpec ? rewindMachine(job, CPU, undo, startCycle + cycles) : 0;
+
+    if (checkpoints) {
+        scope = PhaseBegin();
+        int failed = checkpointCycle != cycles - rewound && WriteCheckpoint(checkpoints, CPU, startCycle + cycles - rewound) != 0;
+        failed |= CloseCheckpointLog(checkpoints) != 0;
+        checkpoints = NULL;
+        if (failed) {
+            perror("Error writing checkpoint");
+            goto done;
+        }
+        PhaseEnd(PHASE_CHECKPOINT, scope, 1);
+    }
+    if (traceFile) {
+        //flush the rendered lines and make sure they all reached the file
+        scope = PhaseBegin();
+        int failed = CloseTraceWriter(trace);
+        failed |= job->traceStream ? fflush(traceFile) != 0 : fclose(traceFile) != 0;
+        trace = NULL;
+        traceFile = NULL;
+        if (failed) {
+            perror("Error writing trace file");
+            goto done;
+        }
+        if (indexFile) {
+            failed = fclose(indexFile) != 0;
+            indexFile = NULL;
+            if (failed) {
+                perror("Error writing index file");
+                goto done;
+            }
+        }
+        PhaseEnd(PHASE_WRITE, scope, 0);
+    }
+    scope = PhaseBegin();
+    if (profile && writeProfileFiles(job, profile, symbols) != 0) {
+        goto done;
+    }
+    if (job->printStats) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printLabel(job);
+        fprintf(stderr, "%llu cycles in %.3f s (%.2f MIPS, %s engine)\n", (unsigned long long)cycles,
+                seconds, seconds > 0 ? cycles / seconds / 1e6 : 0.0, EngineName(job->engine));
+    }
+    if (job->countOps) {
+        for (int op = 0; op < OP_COUNT; op++) {
+            if (opCounts[op]) {
+                fprintf(stderr, "%-8s %llu\n", OpName(op), (unsigned long long)opCounts[op]);
+            }
+        }
+    }
+    PhaseEnd(PHASE_REPORT, scope, profile || job->printStats || job->countOps);
+    *stopCycle = startCycle + cycles - rewound;
+    result = 0;
+
+done:
+    //whatever is still open when something failed
+    if (trace) {
+        CloseTraceWriter(trace);
+    }
+    if (traceFile && !job->traceStream) {
+        fclose(traceFile);
+    }
+    if (indexFile) {
+        fclose(indexFile);
+    }
+    if (checkpoints) {
+        CloseCheckpointLog(checkpoints);
+    }
+    if (undo) {
+        FreeUndoLog(undo);
+    }
+    if (profile) {
+        FreeProfile(profile);
+    }
+    return result;
+}
+
+//helper function to write the cycle count and registers of the stopped machine as one line
+static int writeState(FILE* stateFile, const MachineState* CPU, uint64_t cycle) {
+    fprintf(stateFile, "cycles=%llu PC=%04X PSR=%04X", (unsigned long long)cycle, CPU->PC, CPU->PSR);
+    for (int r = 0; r < 8; r++) {
+        fprintf(stateFile, " R%d=%04X", r, CPU->R[r]);
+    }
+    fprintf(stateFile, " fault=%d\n", CPU->error);
+    if (fflush(stateFile) != 0) {
+        perror("Error writing machine state");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Run a job on a machine of its own.
+ */
+int RunJob(const SimJob* job) {
+    int result = -1;
+    //initialize machine state structure (zeroed, so memory and the decode cache start empty) and reset CPU
+    MachineState* CPU = job->sharedImage ? MapSharedImage(job->sharedImage) : calloc(1, sizeof(MachineState));
+    //the obj files' labels and line numbers, to name addresses by
+    SymbolTable* symbols = job->baseSymbols ? CopySymbolTable(job->baseSymbols) : CreateSymbolTable();
+    //the words every obj file loaded, starting with the ones of the base image
+    LoadMap loads = { 0 };
+    if (CPU == NULL || symbols == NULL) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+    if (job->baseLoads && CopyLoadMap(&loads, job->baseLoads) != 0) {
+        goto done;
+    }
+    int baseFiles = loads.count;
+    //a mapped machine already is the preloaded image
+    if (job->baseImage && !job->sharedImage) {
+        *CPU = *job->baseImage;
+        CPU->decoded = NULL;
+    } else if (!job->baseImage) {
+        Reset(CPU);
+    }
+
+    //pick up where a checkpoint left off
+    uint64_t startCycle = 0;
+    uint64_t restoredOffset = CHECKPOINT_NONE;
+    PhaseScope scope = PhaseBegin();
+    if (job->restoreFilename) {
+        if (RestoreCheckpoint(job->restoreFilename, job->restoreCycle, CPU, &startCycle, &restoredOffset) != 0) {
+            goto done;
+        }
+        PhaseEnd(PHASE_RESTORE, scope, 1);
+    }
+
+    //load each obj file into machine's memory, through the image cache if there is one
+    if (job->objCount && job->cacheDir) {
+        if (LoadObjectsCached(job->cacheDir, job->objFiles, job->objCount, CPU, symbols, &loads) != 0) {
+            goto done;
+        }
+    } else if (job->objCount && LoadObjectFiles(job->objFiles, job->objCount, CPU, symbols, &loads) != 0) {
+        goto done;
+    }
+    //then the ones handed over in memory
+    for (int i = 0; i < job->objBufferCount; i++) {
+        ObjectSections list = { 0 };
+        char name[32];
+        snprintf(name, sizeof(name), "in-memory obj %d", i + 1);
+        if (ParseObjectSections(job->objBuffers[i], job->objBufferSizes[i], &list) != 0
+                || ParseObjectSymbols(job->objBuffers[i], job->objBufferSizes[i], symbols) != 0) {
+            printf("Error: obj file %d given in memory is malformed\n", i + 1);
+            free(list.sections);
+            goto done;
+        }
+        ApplyObjectSections(&list, CPU);
+        int failed = AddToLoadMap(&loads, name, &list);
+        free(list.sections);
+        if (failed) {
+            goto done;
+        }
+    }
+    if (job->objBufferCount) {
+        SortSymbolTable(symbols);
+    }
+    ReportLoadOverlaps(&loads, baseFiles, job->label);
+
+    //run the program, with a trace if one was requested
+    uint64_t stopCycle = startCycle;
+    if (job->runProgram && runLoaded(job, CPU, symbols, startCycle, restoredOffset, &stopCycle) != 0) {
+        goto done;
+    }
+    if (job->stateStream && writeState(job->stateStream, CPU, stopCycle) != 0) {
+        goto done;
+    }
+
+    //output memory contents to the file and we're done
+    scope = PhaseBegin();
+    if (outputMemory(job, CPU) != 0) {
+        goto done;
+    }
+    PhaseEnd(PHASE_DUMP, scope, 1);
+    result = 0;
+
+done:
+    FreeLoadMap(&loads);
+    if (symbols) {
+        FreeSymbolTable(symbols);
+    }
+    if (CPU) {
+        FreeDecodeCache(CPU);
+        if (job->sharedImage) {
+            UnmapMachine(job->sharedImage, CPU);
+        } else {
+            free(CPU);
+        }
+    }
+    return result;
+}
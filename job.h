@@ -0,0 +1,98 @@
+/*
+ * job.h: Declares a simulation job, the unit of work of trace and lc4batch
+ *
+ * A job is everything one command line of trace asks for: the obj files,
+ * the output file and the options. Jobs keep all their state in the job and
+ * the machine they create, so any number can run at once in one process.
+ */
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "LC4.h"
+#include "symbols.h"
+#include "sharedimage.h"
+#include "loader.h"
+
+typedef struct {
+    int engine;
+    char* traceFilename;
+    int traceFormat;
+    int asyncTrace;
+    int traceWorkers;
+    uint32_t indexInterval;
+    int runProgram;
+    uint64_t maxCycles;
+    int printStats;
+    int countOps;
+    char* cacheDir;
+    int binaryDump;
+    char* checkpointFilename;
+    uint64_t checkpointInterval;
+    char* restoreFilename;
+    uint64_t restoreCycle;
+    uint64_t undoHistory;
+    char* rewindSpec;
+    char* profileFilename;
+    char* phasesFilename;
+
+    // where the memory dump goes, and the obj files loaded in order
+    char* outputFilename;
+    char** objFiles;
+    int objCount;
+
+    // Set by the caller rather than from arguments (ParseJobArgs clears them)
+    // the loaded machine and symbols to start from instead of a fresh machine, obj files load on top
+    const MachineState* baseImage;
+    const SymbolTable* baseSymbols;
+    // the files baseImage was loaded from, overlaps with them are reported too
+    const LoadMap* baseLoads;
+    // baseImage shared copy-on-write, if set the machine is mapped from it instead of copied
+    const SharedImage* sharedImage;
+    // obj files already in memory, loaded after objFiles
+    const unsigned char** objBuffers;
+    const size_t* objBufferSizes;
+    int objBufferCount;
+    // names the job at the start of its fault and warning messages, e.g. its manifest line
+    const char* label;
+    // streams taking the trace and the memory dump instead of the named files, and the final
+    // cycle count and registers as one line; they are flushed but left open
+    FILE* traceStream;
+    FILE* outputStream;
+    FILE* stateStream;
+} SimJob;
+
+
+/*
+ * Print how to write a job's arguments, name being the program.
+ */
+void PrintJobUsage(const char* name);
+
+
+/*
+ * Split line in place into whitespace separated arguments, after argv[0] set
+ * to name. argv is allocated and ends in NULL. Returns argc or -1.
+ */
+int SplitJobArgs(char* line, const char* name, char*** argv);
+
+
+/*
+ * Fill in job from trace style arguments (argv[0] is the program name),
+ * printing the usage or an error if they are wrong. The job points into argv.
+ * Without preloaded set at least one obj file is needed (or a checkpoint to restore).
+ * Uses getopt, so only one thread may parse at a time.
+ * Returns 0 on success.
+ */
+int ParseJobArgs(int argc, char** argv, int preloaded, SimJob* job);
+
+
+/*
+ * Run a job: create a machine (or copy the base image), load it, run it with the tracing, checkpoints,
+ * profiling and rewinding it asks for and write its memory dump.
+ * Returns 0 on success, -1 if anything failed (after printing why).
+ */
+int RunJob(const SimJob* job);
+
+#endif
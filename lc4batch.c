@@ -0,0 +1,277 @@
+/*
+ * lc4batch.c: Runs a manifest of simulation jobs on every core of the machine
+ *
+ * Each line of the manifest holds the arguments of one trace run, separated
+ * by whitespace, for example
+ *
+ *   -r -c 1000000 out/sort.txt os.obj sort.obj
+ *
+ * Blank lines and lines starting with # are skipped. The jobs are dealt out
+ * to the workers in contiguous runs; a worker that finishes its run steals
+ * the back half of another worker's, so a few slow jobs do not leave the
+ * other cores idle at the end.
+ */
+
+#include "job.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Most workers lc4batch runs
+#define BATCH_MAX_WORKERS 256
+
+// One manifest line
+typedef struct {
+    int line;
+    // the line's text, split into argv in place
+    char* text;
+    int argc;
+    char** argv;
+    SimJob job;
+    // "manifest line N", what the job's messages start with
+    char* label;
+    // -1 if the line did not parse or the job failed
+    int result;
+} BatchEntry;
+
+// The jobs a worker still has to run: entries next to end - 1
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+} BatchQueue;
+
+typedef struct {
+    BatchEntry* entries;
+    // indices of the entries that parsed, in manifest order
+    int* jobs;
+    BatchQueue* queues;
+    int workerCount;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int self;
+} BatchWorker;
+
+//helper function to print how to run the batch runner
+static void printUsage(const char* name) {
+    printf("Usage: %s [-w workers] manifest\n", name);
+    printf("  each manifest line holds the arguments of one trace run (a manifest named - is read from standard input)\n");
+    printf("  -w  run this many jobs at once (default one per core)\n");
+}
+
+//helper function to take the next job of queue, -1 if it is empty
+static int takeJob(BatchQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    int job = queue->next < queue->end ? queue->next++ : -1;
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+//helper function to move the back half of another worker's jobs (rounded up, so a worker that never
+//started loses its last one too) to this one, returns 0 if there were any
+static int stealJobs(Batch* batch, int self) {
+    for (int i = 1; i < batch->workerCount; i++) {
+        BatchQueue* victim = &batch->queues[(self + i) % batch->workerCount];
+        pthread_mutex_lock(&victim->lock);
+        int left = victim->end - victim->next;
+        if (left > 0) {
+            int middle = victim->end - (left + 1) / 2;
+            BatchQueue* own = &batch->queues[self];
+            pthread_mutex_lock(&own->lock);
+            own->next = middle;
+            own->end = victim->end;
+            pthread_mutex_unlock(&own->lock);
+            victim->end = middle;
+            pthread_mutex_unlock(&victim->lock);
+            return 0;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return -1;
+}
+
+//worker thread: run its own jobs, then steal until no worker has any left
+static void* workerMain(void* arg) {
+    BatchWorker* worker = arg;
+    Batch* batch = worker->batch;
+    while (1) {
+        int job = takeJob(&batch->queues[worker->self]);
+        if (job < 0) {
+            if (stealJobs(batch, worker->self) != 0) {
+                break;
+            }
+            continue;
+        }
+        BatchEntry* entry = &batch->entries[batch->jobs[job]];
+        entry->result = RunJob(&entry->job);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    char* programName = argv[0];
+    long workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+    //parse options
+    int opt;
+    while ((opt = getopt(argc, argv, "w:")) != -1) {
+        switch (opt) {
+            case 'w': {
+                workerCount = atol(optarg);
+                if (workerCount < 1 || workerCount > BATCH_MAX_WORKERS) {
+                    printf("Error: -w takes 1 to %d workers\n", BATCH_MAX_WORKERS);
+                    return -1;
+                }
+                break;
+            }
+            default: {
+                printUsage(programName);
+                return -1;
+            }
+        }
+    }
+    if (argc - optind != 1) {
+        printUsage(programName);
+        return -1;
+    }
+    if (workerCount > BATCH_MAX_WORKERS) {
+        workerCount = BATCH_MAX_WORKERS;
+    }
+
+    //read the manifest, parsing each line as trace would (getopt is not reentrant, so here rather than on the workers)
+    char* manifestName = argv[optind];
+    FILE* manifest = strcmp(manifestName, "-") == 0 ? stdin : fopen(manifestName, "r");
+    if (manifest == NULL) {
+        perror("Error opening manifest");
+        return -1;
+    }
+    BatchEntry* entries = NULL;
+    int entryCount = 0;
+    int entryCapacity = 0;
+    int failed = 0;
+    char* text = NULL;
+    size_t textSize = 0;
+    for (int line = 1; getline(&text, &textSize, manifest) >= 0; line++) {
+        char* start = text + strspn(text, " \t\r\n");
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+        if (entryCount == entryCapacity) {
+            entryCapacity = entryCapacity ? 2 * entryCapacity : 256;
+            BatchEntry* bigger = realloc(entries, entryCapacity * sizeof(BatchEntry));
+            if (bigger == NULL) {
+                printf("Error: out of memory\n");
+                return -1;
+            }
+            entries = bigger;
+        }
+        BatchEntry* entry = &entries[entryCount++];
+        entry->line = line;
+        entry->label = NULL;
+        entry->result = -1;
+        //the job points into its arguments, so each line keeps its own copy
+        entry->text = strdup(start);
+        entry->argc = entry->text ? SplitJobArgs(entry->text, programName, &entry->argv) : -1;
+        if (entry->argc < 0) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+        if (ParseJobArgs(entry->argc, entry->argv, 0, &entry->job) != 0) {
+            printf("Error: %s line %d is not a valid job\n", manifestName, line);
+            failed++;
+            continue;
+        }
+        //phase timings are kept for the whole process, and standard input can only be read once
+        int usesStdin = 0;
+        for (int i = 0; i < entry->job.objCount; i++) {
+            usesStdin |= strcmp(entry->job.objFiles[i], "-") == 0;
+        }
+        if (entry->job.phasesFilename || usesStdin) {
+            printf("Error: %s line %d: -T and obj files read from - cannot be used in a batch\n", manifestName, line);
+            failed++;
+            continue;
+        }
+        entry->label = malloc(strlen(manifestName) + 32);
+        if (entry->label == NULL) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+        sprintf(entry->label, "%s line %d", manifestName, line);
+        entry->job.label = entry->label;
+        entry->result = 0;
+    }
+    free(text);
+    if (manifest != stdin) {
+        fclose(manifest);
+    }
+
+    //deal the jobs that parsed out to the workers in contiguous runs
+    Batch batch = { entries, malloc((entryCount + 1) * sizeof(int)), NULL, 0 };
+    int jobCount = 0;
+    for (int i = 0; i < entryCount; i++) {
+        if (entries[i].result == 0) {
+            batch.jobs[jobCount++] = i;
+        }
+    }
+    if (workerCount > jobCount) {
+        workerCount = jobCount ? jobCount : 1;
+    }
+    batch.workerCount = workerCount;
+    batch.queues = malloc(workerCount * sizeof(BatchQueue));
+    if (batch.jobs == NULL || batch.queues == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    for (int w = 0; w < workerCount; w++) {
+        pthread_mutex_init(&batch.queues[w].lock, NULL);
+        batch.queues[w].next = (int)((long)jobCount * w / workerCount);
+        batch.queues[w].end = (int)((long)jobCount * (w + 1) / workerCount);
+    }
+
+    //run them, this thread being worker 0
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BatchWorker workers[BATCH_MAX_WORKERS];
+    pthread_t threads[BATCH_MAX_WORKERS];
+    int started = 1;
+    for (int w = 0; w < workerCount; w++) {
+        workers[w] = (BatchWorker){ &batch, w };
+    }
+    //a worker that could not be started just leaves its jobs to be stolen
+    for (int w = 1; w < workerCount; w++) {
+        if (pthread_create(&threads[started], NULL, workerMain, &workers[w]) == 0) {
+            started++;
+        }
+    }
+    workerMain(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    //report the jobs that failed, in manifest order
+    for (int j = 0; j < jobCount; j++) {
+        BatchEntry* entry = &entries[batch.jobs[j]];
+        if (entry->result != 0) {
+            fprintf(stderr, "Error: job on %s line %d failed\n", manifestName, entry->line);
+            failed++;
+        }
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d jobs, %d failed, in %.3f s on %ld workers\n", entryCount, failed, seconds, workerCount);
+
+    for (int i = 0; i < entryCount; i++) {
+        free(entries[i].text);
+        free(entries[i].argv);
+        free(entries[i].label);
+    }
+    free(entries);
+    free(batch.jobs);
+    free(batch.queues);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * lc4server.c: Serves simulation jobs over a Unix socket from a warm, preloaded OS image
+ *
+ * The OS obj files named on the command line are loaded once at startup.
+ * Every job then starts from a copy-on-write mapping of that machine (see
+ * sharedimage.h), so it pays for neither process creation nor loading them
+ * again, and the memory pages it does not store to are shared. A client
+ * sends any number of requests on a connection, each made of
+ *
+ *   obj <length>\n<length bytes of an obj file>     (zero or more)
+ *   run <trace arguments>\n
+ *
+ * The run line takes the arguments of trace. Obj files named in it are read
+ * by the server and loaded on top of the OS image, then the obj files sent
+ * with the request, in order. A trace or output file named - is sent back
+ * instead of written. The reply is
+ *
+ *   trace <length>\n<the trace>                      (if it was -)
+ *   dump <length>\n<the memory dump>                 (if it was -)
+ *   state <length>\ncycles=N PC=XXXX PSR=XXXX R0=XXXX ... R7=XXXX fault=0\n
+ *   ok\n
+ *
+ * or just failed\n, the reason being printed in the server's log. A request
+ * line the server does not understand is answered with failed\n and ends the
+ * connection. Each connection runs its jobs one at a time, connections run
+ * concurrently.
+ */
+
+#include "job.h"
+#include "loader.h"
+#include "decode.h"
+#include "sharedimage.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Largest obj file a client may send
+#define SERVER_MAX_OBJ_BYTES (64 << 20)
+
+// What every connection shares, read only once the server is listening
+typedef struct {
+    MachineState* image;
+    // the image again, NULL where it cannot be shared
+    SharedImage* shared;
+    SymbolTable* symbols;
+    // the words each of the OS obj files loaded, jobs report overlaps with them
+    LoadMap loads;
+    uint64_t maxCycles;
+} Server;
+
+typedef struct {
+    const Server* server;
+    int fd;
+} Connection;
+
+// The obj files sent ahead of a run line
+typedef struct {
+    unsigned char** data;
+    size_t* sizes;
+    int count;
+    int capacity;
+} ObjBuffers;
+
+// getopt is not reentrant, connections take turns parsing
+static pthread_mutex_t parseLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Jobs run so far, numbering the ones whose dump is sent back in the log
+static _Atomic unsigned long jobsRun;
+
+//helper function to print how to run the server
+static void printUsage(const char* name) {
+    printf("Usage: %s [-c max_cycles] socket [os.obj ...]\n", name);
+    printf("  loads the obj files once and runs the jobs sent to the Unix socket on copies of that machine (protocol in lc4server.c)\n");
+    printf("  -c  stop every job after this many cycles, whatever it asks for\n");
+}
+
+//helper function to send one section of a reply
+static void sendSection(FILE* reply, const char* name, const char* data, size_t size) {
+    fprintf(reply, "%s %zu\n", name, size);
+    fwrite(data, 1, size, reply);
+}
+
+//helper function to forget the obj files of the last request
+static void clearObjBuffers(ObjBuffers* objs) {
+    for (int i = 0; i < objs->count; i++) {
+        free(objs->data[i]);
+    }
+    objs->count = 0;
+}
+
+//helper function to read an obj file of size bytes from the connection, returns 0 on success
+static int readObjBuffer(FILE* request, size_t size, ObjBuffers* objs) {
+    if (objs->count == objs->capacity) {
+        int bigger = objs->capacity ? 2 * objs->capacity : 4;
+        unsigned char** data = realloc(objs->data, bigger * sizeof(unsigned char*));
+        if (data) {
+            objs->data = data;
+        }
+        size_t* sizes = realloc(objs->sizes, bigger * sizeof(size_t));
+        if (sizes) {
+            objs->sizes = sizes;
+        }
+        if (data == NULL || sizes == NULL) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+        objs->capacity = bigger;
+    }
+    unsigned char* data = malloc(size);
+    if (data == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    if (fread(data, 1, size, request) != size) {
+        free(data);
+        return -1;
+    }
+    objs->data[objs->count] = data;
+    objs->sizes[objs->count++] = size;
+    return 0;
+}
+
+//helper function to run the job of a run line and reply with its results
+static void runRequest(const Server* server, char* args, const ObjBuffers* objs, FILE* reply) {
+    int result = -1;
+    char** argv = NULL;
+    char* trace = NULL;
+    char* dump = NULL;
+    char* state = NULL;
+    size_t traceSize = 0;
+    size_t dumpSize = 0;
+    size_t stateSize = 0;
+    SimJob job;
+
+    int argc = SplitJobArgs(args, "run", &argv);
+    if (argc < 0) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+    pthread_mutex_lock(&parseLock);
+    int parsed = ParseJobArgs(argc, argv, 1, &job);
+    pthread_mutex_unlock(&parseLock);
+    if (parsed != 0) {
+        goto done;
+    }
+    //the machine comes from the image, phase timings are kept for the whole process
+    //and standard input is the server's
+    int usesStdin = 0;
+    for (int i = 0; i < job.objCount; i++) {
+        usesStdin |= strcmp(job.objFiles[i], "-") == 0;
+    }
+    if (job.restoreFilename || job.cacheDir || job.phasesFilename || usesStdin) {
+        printf("Error: -R, -m, -T and obj files read from - cannot be used in a server job\n");
+        goto done;
+    }
+    int traceBack = job.traceFilename && strcmp(job.traceFilename, "-") == 0;
+    if (traceBack && job.indexInterval) {
+        printf("Error: -i needs the trace written to a file\n");
+        goto done;
+    }
+    if (job.maxCycles > server->maxCycles) {
+        job.maxCycles = server->maxCycles;
+    }
+
+    job.baseImage = server->image;
+    job.baseSymbols = server->symbols;
+    job.baseLoads = &server->loads;
+    job.sharedImage = server->shared;
+    job.objBuffers = (const unsigned char**)objs->data;
+    job.objBufferSizes = objs->sizes;
+    job.objBufferCount = objs->count;
+    //the log names the job by its output file, or by number if it has none
+    char label[32];
+    unsigned long number = atomic_fetch_add(&jobsRun, 1) + 1;
+    snprintf(label, sizeof(label), "job %lu", number);
+    job.label = strcmp(job.outputFilename, "-") == 0 ? label : job.outputFilename;
+    job.traceStream = traceBack ? open_memstream(&trace, &traceSize) : NULL;
+    job.outputStream = strcmp(job.outputFilename, "-") == 0 ? open_memstream(&dump, &dumpSize) : NULL;
+    job.stateStream = open_memstream(&state, &stateSize);
+    if ((traceBack && job.traceStream == NULL) || (strcmp(job.outputFilename, "-") == 0 && job.outputStream == NULL)
+            || job.stateStream == NULL) {
+        printf("Error: out of memory\n");
+    } else {
+        result = RunJob(&job);
+    }
+    //closing the streams settles their buffers
+    if (job.traceStream) {
+        fclose(job.traceStream);
+    }
+    if (job.outputStream) {
+        fclose(job.outputStream);
+    }
+    if (job.stateStream) {
+        fclose(job.stateStream);
+    }
+
+done:
+    if (result == 0) {
+        if (trace) {
+            sendSection(reply, "trace", trace, traceSize);
+        }
+        if (dump) {
+            sendSection(reply, "dump", dump, dumpSize);
+        }
+        sendSection(reply, "state", state, stateSize);
+    }
+    fprintf(reply, result == 0 ? "ok\n" : "failed\n");
+    free(trace);
+    free(dump);
+    free(state);
+    free(argv);
+}
+
+//connection thread: serve requests until the client hangs up or sends something that is not one
+static void* connectionMain(void* arg) {
+    Connection* connection = arg;
+    FILE* request = fdopen(connection->fd, "r");
+    int replyFd = dup(connection->fd);
+    FILE* reply = replyFd >= 0 ? fdopen(replyFd, "w") : NULL;
+    ObjBuffers objs = { 0 };
+    char* line = NULL;
+    size_t lineSize = 0;
+    if (request == NULL || reply == NULL) {
+        printf("Error: could not set up a connection\n");
+        goto done;
+    }
+    while (getline(&line, &lineSize, request) > 0) {
+        if (strncmp(line, "obj ", 4) == 0) {
+            char* end;
+            unsigned long long size = strtoull(line + 4, &end, 10);
+            if (end != line + 4 && *end == '\n' && size > 0 && size <= SERVER_MAX_OBJ_BYTES
+                    && readObjBuffer(request, size, &objs) == 0) {
+                continue;
+            }
+        } else if (strncmp(line, "run", 3) == 0 && (line[3] == ' ' || line[3] == '\n')) {
+            runRequest(connection->server, line + 3, &objs, reply);
+            clearObjBuffers(&objs);
+            if (fflush(reply) != 0) {
+                break;
+            }
+            continue;
+        }
+        //out of step with the client, nothing after this can be trusted
+        fprintf(reply, "failed\n");
+        break;
+    }
+
+done:
+    clearObjBuffers(&objs);
+    free(objs.data);
+    free(objs.sizes);
+    free(line);
+    if (reply) {
+        fclose(reply);
+    } else if (replyFd >= 0) {
+        close(replyFd);
+    }
+    if (request) {
+        fclose(request);
+    } else {
+        close(connection->fd);
+    }
+    free(connection);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    char* programName = argv[0];
+    Server server = { NULL, NULL, NULL, { 0 }, UINT64_MAX };
+
+    //parse options
+    int opt;
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+            case 'c': {
+                server.maxCycles = strtoull(optarg, NULL, 0);
+                break;
+            }
+            default: {
+                printUsage(programName);
+                return -1;
+            }
+        }
+    }
+    if (argc - optind < 1) {
+        printUsage(programName);
+        return -1;
+    }
+    char* socketName = argv[optind];
+
+    //load the OS image every job starts from
+    server.image = calloc(1, sizeof(MachineState));
+    server.symbols = CreateSymbolTable();
+    if (server.image == NULL || server.symbols == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    Reset(server.image);
+    int objCount = argc - optind - 1;
+    if (objCount && LoadObjectFiles(argv + optind + 1, objCount, server.image, server.symbols, &server.loads) != 0) {
+        return -1;
+    }
+    ReportLoadOverlaps(&server.loads, 0, NULL);
+    //the jobs copy the image but not its decode cache
+    FreeDecodeCache(server.image);
+    server.shared = CreateSharedImage(server.image);
+    if (server.shared == NULL) {
+        fprintf(stderr, "Warning: cannot share the image, every job gets a full copy\n");
+    }
+
+    //listen on the socket, replacing one left behind by an earlier server
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socketName) >= sizeof(address.sun_path)) {
+        printf("Error: socket name %s is too long\n", socketName);
+        return -1;
+    }
+    strcpy(address.sun_path, socketName);
+    struct stat status;
+    if (lstat(socketName, &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(socketName);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        perror("Error opening socket");
+        return -1;
+    }
+
+    //a client hanging up shows up as a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+    //the log is read while the server runs
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    fprintf(stderr, "serving %s with %d obj files preloaded\n", socketName, objCount);
+
+    while (1) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("Error accepting connection");
+            }
+            continue;
+        }
+        Connection* connection = malloc(sizeof(Connection));
+        pthread_t thread;
+        if (connection) {
+            *connection = (Connection){ &server, fd };
+        }
+        if (connection == NULL || pthread_create(&thread, NULL, connectionMain, connection) != 0) {
+            printf("Error: could not start a connection\n");
+            free(connection);
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
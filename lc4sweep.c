@@ -0,0 +1,208 @@
+/*
+ * lc4sweep.c: Runs one program over many inputs at once on the lockstep engine
+ *
+ * The obj files on the command line (the OS and the program) are loaded once.
+ * Each line of the sweep file then describes one machine: the file its memory
+ * dump goes to, followed by the obj files holding its own inputs, loaded on
+ * top, for example
+ *
+ *   out/sort1.txt inputs/sort1.obj
+ *
+ * Blank lines and lines starting with # are skipped. Every machine ends as
+ * trace -r would leave it, so its dump is the same as that of
+ * trace -r out/sort1.txt os.obj sort.obj inputs/sort1.obj.
+ */
+
+#include "sweep.h"
+#include "loader.h"
+#include "memdump.h"
+#include "sharedimage.h"
+#include "job.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// One line of the sweep file
+typedef struct {
+    int line;
+    char* text;
+    char** argv;
+    MachineState* machine;
+} SweepLane;
+
+//helper function to print how to run a sweep
+static void printUsage(const char* name) {
+    printf("Usage: %s [-c max_cycles] [-s] sweep.txt first.obj [second.obj ...]\n", name);
+    printf("  each sweep.txt line holds an output file and the obj files loaded on top of the others for one machine\n");
+    printf("  -c  stop every machine after this many cycles\n");
+    printf("  -s  print the cycle count, MIPS and machines per step to stderr\n");
+}
+
+//helper function to write a lane's memory dump, returns 0 on success
+static int writeDump(const char* filename, MachineState* CPU) {
+    FILE* outputFile = fopen(filename, "w");
+    if (outputFile == NULL) {
+        perror("Error opening output file");
+        return -1;
+    }
+    int failed = WriteMemoryDump(outputFile, CPU);
+    if (fclose(outputFile) != 0 || failed) {
+        perror("Error writing output file");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    char* programName = argv[0];
+    uint64_t maxCycles = UINT64_MAX;
+    int printStats = 0;
+
+    //parse options
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s")) != -1) {
+        switch (opt) {
+            case 'c': {
+                maxCycles = strtoull(optarg, NULL, 0);
+                break;
+            }
+            case 's': {
+                printStats = 1;
+                break;
+            }
+            default: {
+                printUsage(programName);
+                return -1;
+            }
+        }
+    }
+    if (argc - optind < 2) {
+        printUsage(programName);
+        return -1;
+    }
+    char* sweepName = argv[optind];
+
+    //load what every machine shares once, each lane maps it copy-on-write where it can
+    MachineState* base = calloc(1, sizeof(MachineState));
+    if (base == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    Reset(base);
+    if (LoadObjectFiles(argv + optind + 1, argc - optind - 1, base, NULL, NULL) != 0) {
+        return -1;
+    }
+    FreeDecodeCache(base);
+    SharedImage* image = CreateSharedImage(base);
+
+    //read the sweep file, loading each lane's own obj files on top
+    FILE* sweepFile = fopen(sweepName, "r");
+    if (sweepFile == NULL) {
+        perror("Error opening sweep file");
+        return -1;
+    }
+    SweepLane* lanes = NULL;
+    int laneCount = 0;
+    int laneCapacity = 0;
+    char* text = NULL;
+    size_t textSize = 0;
+    for (int line = 1; getline(&text, &textSize, sweepFile) >= 0; line++) {
+        char* start = text + strspn(text, " \t\r\n");
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+        if (laneCount == laneCapacity) {
+            laneCapacity = laneCapacity ? 2 * laneCapacity : 64;
+            SweepLane* bigger = realloc(lanes, laneCapacity * sizeof(SweepLane));
+            if (bigger == NULL) {
+                printf("Error: out of memory\n");
+                return -1;
+            }
+            lanes = bigger;
+        }
+        SweepLane* lane = &lanes[laneCount++];
+        lane->line = line;
+        lane->text = strdup(start);
+        int laneArgc = lane->text ? SplitJobArgs(lane->text, sweepName, &lane->argv) : -1;
+        lane->machine = image ? MapSharedImage(image) : malloc(sizeof(MachineState));
+        if (laneArgc < 0 || lane->machine == NULL) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+        if (!image) {
+            *lane->machine = *base;
+        }
+        //argv[1] is the output file, the rest are the lane's obj files
+        if (laneArgc < 2) {
+            printf("Error: %s line %d has no output file\n", sweepName, line);
+            return -1;
+        }
+        if (laneArgc > 2 && LoadObjectFiles(lane->argv + 2, laneArgc - 2, lane->machine, NULL, NULL) != 0) {
+            printf("Error: %s line %d could not be loaded\n", sweepName, line);
+            return -1;
+        }
+    }
+    free(text);
+    fclose(sweepFile);
+    if (laneCount == 0) {
+        printf("Error: %s holds no machines\n", sweepName);
+        return -1;
+    }
+
+    //run them all in lockstep
+    MachineState** machines = malloc(laneCount * sizeof(MachineState*));
+    if (machines == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    for (int l = 0; l < laneCount; l++) {
+        machines[l] = lanes[l].machine;
+    }
+    Sweep* sweep = CreateSweep(machines, laneCount);
+    if (sweep == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t cycles = RunSweep(sweep, maxCycles);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    SweepWriteBack(sweep);
+
+    if (printStats) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%llu cycles on %d machines in %.3f s (%.2f MIPS, %.1f machines per step)\n",
+                (unsigned long long)cycles, laneCount, seconds, seconds > 0 ? cycles / seconds / 1e6 : 0.0,
+                sweep->steps ? (double)cycles / sweep->steps : 0.0);
+    }
+
+    //report the machines that faulted and write every dump
+    int failed = 0;
+    for (int l = 0; l < laneCount; l++) {
+        if (machines[l]->error) {
+            fprintf(stderr, "Error: machine on %s line %d faulted at x%04X after %llu cycles\n", sweepName,
+                    lanes[l].line, machines[l]->PC, (unsigned long long)sweep->cycles[l]);
+        }
+        failed |= writeDump(lanes[l].argv[1], machines[l]) != 0;
+    }
+
+    FreeSweep(sweep);
+    for (int l = 0; l < laneCount; l++) {
+        if (image) {
+            UnmapMachine(image, lanes[l].machine);
+        } else {
+            free(lanes[l].machine);
+        }
+        free(lanes[l].text);
+        free(lanes[l].argv);
+    }
+    if (image) {
+        FreeSharedImage(image);
+    }
+    free(machines);
+    free(lanes);
+    free(base);
+    return failed ? -1 : 0;
+}
@@ -3,8 +3,18 @@
  */
 
 #include "loader.h"
+#include "phases.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 //define headers for different kinds of words in the obj file
 #define CODE_HEADER 0xCADE
@@ -13,93 +23,525 @@
 #define FILENAME_HEADER 0xF17E
 #define LINENUMBER_HEADER 0x715E
 
-// memory array location
-unsigned short memoryAddress;
-
-/*
- * Read an object file and modify the machine state as described in the writeup
- */
-
-int reached_eof;
-
-//helper function to read a word from the file
-uint16_t readWord(FILE *file) {
-  uint16_t word;
-  if(fread(&word, sizeof(uint16_t), 1, file) == 0) reached_eof = 1;
-  // Swap bytes to handle endianness
-    return ((word >> 8) & 0xFF) | ((word & 0xFF) << 8);
+//helper function to read a big endian word from a mapped file
+static inline uint16_t getWord(const unsigned char* data) {
+  return (data[0] << 8) | data[1];
 }
 
-int ReadObjectFile(char* filename, MachineState* CPU) {
-  //open file in binary read mode
-
-  reached_eof = 0;
-
-  FILE *file = fopen(filename, "rb");
-
-  if (file == NULL) {
-        perror("Error opening file");
-        return -1;
+//helper function to copy n big endian words into memory from address on, wrapping at the end of memory
+static void copyWords(MachineState* CPU, uint16_t address, const unsigned char* src, size_t n) {
+  MarkWrittenRange(CPU, address, n);
+  while (n) {
+    //split the copy where the address wraps around
+    size_t count = (size_t)(65536 - address) < n ? (size_t)(65536 - address) : n;
+    unsigned short* dst = CPU->memory + address;
+    size_t i = 0;
+#ifdef __SSE2__
+    //swap the bytes of eight words at a time
+    for (; i + 8 <= count; i += 8) {
+      __m128i words = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+      words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+      _mm_storeu_si128((__m128i*)(dst + i), words);
     }
+#endif
+    for (; i < count; i++) {
+      dst[i] = getWord(src + 2 * i);
+    }
+    src += 2 * count;
+    n -= count;
+    address = 0;
+  }
+}
 
-  //loop through everything in the file
-  while (!feof(file)) {
-    //read each header in the file
-    uint16_t header = readWord(file);
+//helper function to append a section to a list, returns 0 on success
+static int addSection(ObjectSections* list, uint16_t address, uint16_t count, const unsigned char* words) {
+  if (list->count == list->capacity) {
+    int capacity = list->capacity ? 2 * list->capacity : 16;
+    ObjectSection* sections = realloc(list->sections, capacity * sizeof(ObjectSection));
+    if (sections == NULL) {
+      printf("Error: out of memory\n");
+      return -1;
+    }
+    list->sections = sections;
+    list->capacity = capacity;
+  }
+  list->sections[list->count++] = (ObjectSection){ address, count, words };
+  return 0;
+}
 
-    if(reached_eof) break;
+/*
+ * Find the CODE and DATA sections of an object file held in memory
+ */
+int ParseObjectSections(const unsigned char* data, size_t size, ObjectSections* list) {
+  size_t pos = 0;
+  //a trailing odd byte can't hold a header, just like with the stdio reader
+  while (pos + 2 <= size) {
+    uint16_t header = getWord(data + pos);
+    pos += 2;
+    //how many whole words are left, truncated sections are loaded as far as they go
+    size_t words = (size - pos) / 2;
 
     switch (header) {
-      //if the word is a code header 
-      case CODE_HEADER: {
-        uint16_t address = readWord(file);
-        uint16_t n = readWord(file);
-        //loop through all instructions
-        for (int i = 0; i < n; i++) {
-          //populate the cpu memory with the instruction
-          uint16_t instruction = readWord(file);
-          CPU->memory[address + i] = instruction;
-        }
+      case CODE_HEADER:
+      case DATA_HEADER: {
+        if (words < 2) return 0;
+        uint16_t address = getWord(data + pos);
+        uint16_t n = getWord(data + pos + 2);
+        pos += 4;
+        words -= 2;
+        if (n && words && addSection(list, address, n < words ? n : words, data + pos) != 0) return -1;
+        pos += 2 * (size_t)n;
+        break;
+      }
+      //for the other three cases we only skip over the payload
+      case SYMBOL_HEADER: {
+        if (words < 2) return 0;
+        pos += 4 + getWord(data + pos + 2);
+        break;
+      }
+      case FILENAME_HEADER: {
+        if (words < 1) return 0;
+        pos += 2 + getWord(data + pos);
+        break;
+      }
+      case LINENUMBER_HEADER: {
+        pos += 6;
         break;
       }
+      default: printf("Bad header\n"); return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Collect the SYMBOL, FILENAME and LINENUMBER sections of an object file held in memory
+ */
+int ParseObjectSymbols(const unsigned char* data, size_t size, SymbolTable* table) {
+  //LINENUMBER sections count FILENAME sections from the start of their own file
+  int firstFile = table->fileCount;
+  int firstLine = table->lineCount;
+  size_t pos = 0;
+  while (pos + 2 <= size) {
+    uint16_t header = getWord(data + pos);
+    pos += 2;
+    size_t left = size - pos;
+
+    switch (header) {
+      case CODE_HEADER:
       case DATA_HEADER: {
-        uint16_t address = readWord(file);
-        uint16_t n = readWord(file);
-        //loop through all data words
-        for (int i = 0; i < n; i++) {
-          //populate the cpu memory with the data
-          uint16_t data = readWord(file);
-          CPU->memory[address + i] = data;
-        }
+        if (left < 4) goto done;
+        pos += 4 + 2 * (size_t)getWord(data + pos + 2);
         break;
       }
-      //for the other three cases we don't need to do anything
       case SYMBOL_HEADER: {
-        uint16_t word = readWord(file);
-        word = readWord(file);
-        uint8_t byte;
-        for (int i = 0; i < word; i++) {
-          fread(&byte, sizeof byte, 1, file);
-        }
+        if (left < 4) goto done;
+        uint16_t address = getWord(data + pos);
+        size_t n = getWord(data + pos + 2);
+        if (AddSymbol(table, address, (const char*)data + pos + 4, n < left - 4 ? n : left - 4) != 0) goto nomem;
+        pos += 4 + n;
         break;
       }
       case FILENAME_HEADER: {
-        uint16_t word = readWord(file);
-        uint8_t byte;
-        for (int i = 0; i < word; i++) {
-          fread(&byte, sizeof byte, 1, file);
-        }
+        if (left < 2) goto done;
+        size_t n = getWord(data + pos);
+        if (AddSourceFile(table, (const char*)data + pos + 2, n < left - 2 ? n : left - 2) < 0) goto nomem;
+        pos += 2 + n;
         break;
       }
       case LINENUMBER_HEADER: {
-        readWord(file);
-        readWord(file);
-        readWord(file);
+        if (left >= 6 && AddLine(table, getWord(data + pos), getWord(data + pos + 2), getWord(data + pos + 4)) != 0) goto nomem;
+        pos += 6;
         break;
       }
-      default: printf("Bad header\n"); return -1;
+      default: goto done;
+    }
+  }
+done:
+  for (int i = firstLine; i < table->lineCount; i++) {
+    uint32_t file = firstFile + table->lines[i].file;
+    table->lines[i].file = file < (uint32_t)table->fileCount ? file : SYMBOL_NO_FILE;
+  }
+  return 0;
+
+nomem:
+  printf("Error: out of memory\n");
+  return -1;
+}
+
+/*
+ * Copy parsed sections into memory, in order
+ */
+void ApplyObjectSections(const ObjectSections* list, MachineState* CPU) {
+  PhaseScope scope = PhaseBegin();
+  uint64_t words = 0;
+  for (int i = 0; i < list->count; i++) {
+    copyWords(CPU, list->sections[i].address, list->sections[i].words, list->sections[i].count);
+    words += list->sections[i].count;
+  }
+  PhaseEnd(PHASE_APPLY, scope, words);
+}
+
+//helper function to read a whole stream into a malloced buffer, returns 0 on success
+static int readStream(FILE* file, unsigned char** data, size_t* size) {
+  size_t capacity = 1 << 16;
+  *size = 0;
+  *data = malloc(capacity);
+  while (*data) {
+    *size += fread(*data + *size, 1, capacity - *size, file);
+    if (*size < capacity) {
+      return ferror(file) ? -1 : 0;
+    }
+    unsigned char* bigger = realloc(*data, 2 * capacity);
+    if (bigger == NULL) {
+      break;
     }
+    *data = bigger;
+    capacity *= 2;
   }
+  printf("Error: out of memory\n");
+  return -1;
+}
+
+/*
+ * Read an object file from an open stream, e.g. standard input
+ */
+int ReadObjectStream(FILE* file, MachineState* CPU) {
+  //read it whole and parse it like a mapped file
+  unsigned char* data;
+  size_t size;
+  int result = readStream(file, &data, &size);
+  if (result == 0) {
+    result = LoadObjectBuffer(data, size, CPU);
+  }
+  free(data);
+  return result;
+}
+
+/*
+ * Load the sections of an object file held in memory
+ */
+int LoadObjectBuffer(const unsigned char* data, size_t size, MachineState* CPU) {
+  ObjectSections list = { 0 };
+  PhaseScope scope = PhaseBegin();
+  int result = ParseObjectSections(data, size, &list);
+  PhaseEnd(PHASE_PARSE, scope, size);
+  if (result == 0) {
+    ApplyObjectSections(&list, CPU);
+  }
+  free(list.sections);
+  return result;
+}
+
+int ReadObjectFile(char* filename, MachineState* CPU) {
+  //"-" is standard input
+  if (strcmp(filename, "-") == 0) {
+    return ReadObjectStream(stdin, CPU);
+  }
+
+  //open the file once, everything below works from this descriptor
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("Error opening file");
+    return -1;
+  }
+
+  //map regular files and parse them in place
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      close(fd);
+      int result = LoadObjectBuffer(data, info.st_size, CPU);
+      munmap(data, info.st_size);
+      return result;
+    }
+  }
+
+  //pipes and anything else that can't be mapped are read through stdio
+  FILE *file = fdopen(fd, "rb");
+  if (file == NULL) {
+    perror("Error opening file");
+    close(fd);
+    return -1;
+  }
+  int result = ReadObjectStream(file, CPU);
   fclose(file);
+  return result;
+}
+
+// One obj file being loaded by LoadObjectFiles
+typedef struct {
+  char* filename;
+  // mapped file, or the bytes read from a stream
+  unsigned char* data;
+  size_t size;
+  int mapped;
+  ObjectSections sections;
+  int result;
+} ObjectJob;
+
+// Work shared by the parsing threads
+typedef struct {
+  ObjectJob* jobs;
+  int count;
+  _Atomic int next;
+} ObjectBatch;
+
+//helper function to get one file's bytes (mapped if it is a regular file) and parse its sections
+static void parseJob(ObjectJob* job) {
+  if (strcmp(job->filename, "-") == 0) {
+    job->result = readStream(stdin, &job->data, &job->size);
+  } else {
+    int fd = open(job->filename, O_RDONLY);
+    if (fd < 0) {
+      perror("Error opening file");
+      job->result = -1;
+      return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+      void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        job->data = data;
+        job->size = info.st_size;
+        job->mapped = 1;
+      }
+    }
+    if (!job->mapped) {
+      FILE* file = fdopen(fd, "rb");
+      job->result = file ? readStream(file, &job->data, &job->size) : -1;
+      if (file) {
+        fclose(file);
+      } else {
+        close(fd);
+      }
+    } else {
+      close(fd);
+    }
+  }
+  if (job->result == 0) {
+    PhaseScope scope = PhaseBegin();
+    job->result = ParseObjectSections(job->data, job->size, &job->sections);
+    PhaseEnd(PHASE_PARSE, scope, job->size);
+  }
+}
+
+//parsing thread: take files off the batch until none are left
+static void* parseThreadMain(void* arg) {
+  ObjectBatch* batch = arg;
+  int i;
+  while ((i = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+    parseJob(&batch->jobs[i]);
+  }
+  MergeThreadPhases();
+  return NULL;
+}
+
+//helper function to append an empty bitmap for name to a load map, NULL if out of memory
+static uint64_t* addLoadBitmap(LoadMap* loads, const char* name) {
+  if (loads->count == loads->capacity) {
+    int capacity = loads->capacity ? 2 * loads->capacity : 8;
+    char** names = realloc(loads->names, capacity * sizeof(char*));
+    if (names == NULL) {
+      return NULL;
+    }
+    loads->names = names;
+    uint64_t* bitmaps = realloc(loads->loads, (size_t)capacity * LOAD_MAP_WORDS * sizeof(uint64_t));
+    if (bitmaps == NULL) {
+      return NULL;
+    }
+    loads->loads = bitmaps;
+    loads->capacity = capacity;
+  }
+  char* copy = strdup(name);
+  if (copy == NULL) {
+    return NULL;
+  }
+  loads->names[loads->count] = copy;
+  uint64_t* map = loads->loads + (size_t)loads->count++ * LOAD_MAP_WORDS;
+  memset(map, 0, LOAD_MAP_WORDS * sizeof(uint64_t));
+  return map;
+}
+
+/*
+ * Add a file loaded after the ones already in loads
+ */
+int AddToLoadMap(LoadMap* loads, const char* name, const ObjectSections* list) {
+  uint64_t* map = addLoadBitmap(loads, name);
+  if (map == NULL) {
+    printf("Error: out of memory\n");
+    return -1;
+  }
+  for (int s = 0; s < list->count; s++) {
+    const ObjectSection* section = &list->sections[s];
+    for (int i = 0; i < section->count; i++) {
+      uint16_t address = section->address + i;
+      map[address / 64] |= 1ULL << (address % 64);
+    }
+  }
   return 0;
 }
+
+/*
+ * Add every file of src to loads
+ */
+int CopyLoadMap(LoadMap* loads, const LoadMap* src) {
+  for (int f = 0; f < src->count; f++) {
+    uint64_t* map = addLoadBitmap(loads, src->names[f]);
+    if (map == NULL) {
+      printf("Error: out of memory\n");
+      return -1;
+    }
+    memcpy(map, src->loads + (size_t)f * LOAD_MAP_WORDS, LOAD_MAP_WORDS * sizeof(uint64_t));
+  }
+  return 0;
+}
+
+//helper function to print one span two files both load
+static void reportSpan(const LoadMap* loads, const char* label, int first, int second, int start, int last, int kept) {
+  fprintf(stderr, "%s%sWarning: %s and %s both load x%04X-x%04X, keeping %s\n", label ? label : "", label ? ": " : "",
+          loads->names[first], loads->names[second], start, last, loads->names[kept]);
+}
+
+/*
+ * Warn about every span two files both load, naming the file whose words are kept
+ */
+void ReportLoadOverlaps(const LoadMap* loads, int first, const char* label) {
+  int count = loads->count;
+  if (count < 2 || first >= count) {
+    return;
+  }
+  //the last file to load each word (files are copied in load order, so its words are
+  //the ones left in memory)
+  int* owner = malloc(65536 * sizeof(int));
+  if (owner == NULL) {
+    return;
+  }
+  for (int f = 0; f < count; f++) {
+    const uint64_t* map = loads->loads + (size_t)f * LOAD_MAP_WORDS;
+    for (int w = 0; w < LOAD_MAP_WORDS; w++) {
+      for (uint64_t bits = map[w]; bits; bits &= bits - 1) {
+        owner[w * 64 + __builtin_ctzll(bits)] = f;
+      }
+    }
+  }
+
+  //every pair with a file from first on, in spans of consecutive words kept from the same file
+  for (int one = 0; one < count; one++) {
+    for (int second = one + 1 > first ? one + 1 : first; second < count; second++) {
+      const uint64_t* a = loads->loads + (size_t)one * LOAD_MAP_WORDS;
+      const uint64_t* b = loads->loads + (size_t)second * LOAD_MAP_WORDS;
+      int start = -1;
+      int last = -1;
+      for (int w = 0; w < LOAD_MAP_WORDS; w++) {
+        uint64_t both = a[w] & b[w];
+        while (both) {
+          int address = w * 64 + __builtin_ctzll(both);
+          both &= both - 1;
+          if (start >= 0 && (address != last + 1 || owner[address] != owner[last])) {
+            reportSpan(loads, label, one, second, start, last, owner[last]);
+            start = -1;
+          }
+          if (start < 0) {
+            start = address;
+          }
+          last = address;
+        }
+      }
+      if (start >= 0) {
+        reportSpan(loads, label, one, second, start, last, owner[last]);
+      }
+    }
+  }
+  free(owner);
+}
+
+/*
+ * Free what a load map holds, leaving it empty
+ */
+void FreeLoadMap(LoadMap* loads) {
+  for (int f = 0; f < loads->count; f++) {
+    free(loads->names[f]);
+  }
+  free(loads->names);
+  free(loads->loads);
+  *loads = (LoadMap){ 0 };
+}
+
+/*
+ * Load several object files: parsed concurrently, copied into memory in order
+ */
+int LoadObjectFiles(char** files, int count, MachineState* CPU, SymbolTable* symbols, LoadMap* loads) {
+  ObjectJob* jobs = calloc(count, sizeof(ObjectJob));
+  if (jobs == NULL) {
+    printf("Error: out of memory\n");
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    jobs[i].filename = files[i];
+  }
+  PhaseScope scope = PhaseBegin();
+
+  //parse on up to one thread per core, this thread included
+  ObjectBatch batch = { jobs, count, 0 };
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int threadCount = count - 1 < cores - 1 ? count - 1 : cores - 1;
+  pthread_t threads[LOADER_MAX_THREADS];
+  if (threadCount > LOADER_MAX_THREADS) {
+    threadCount = LOADER_MAX_THREADS;
+  }
+  int started = 0;
+  while (started < threadCount && pthread_create(&threads[started], NULL, parseThreadMain, &batch) == 0) {
+    started++;
+  }
+  parseThreadMain(&batch);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  //merge in argv order, so later files overwrite earlier ones as they always have
+  int result = 0;
+  for (int i = 0; i < count; i++) {
+    if (jobs[i].result != 0) {
+      printf("Error loading file %s\n", jobs[i].filename);
+      result = -1;
+      break;
+    }
+    ApplyObjectSections(&jobs[i].sections, CPU);
+    //debug sections are collected in argv order too, so line file indices stay per file
+    PhaseScope symbolScope = PhaseBegin();
+    if (symbols && ParseObjectSymbols(jobs[i].data, jobs[i].size, symbols) != 0) {
+      result = -1;
+      break;
+    }
+    PhaseEnd(PHASE_SYMBOLS, symbolScope, 0);
+  }
+  if (result == 0 && symbols) {
+    PhaseScope symbolScope = PhaseBegin();
+    SortSymbolTable(symbols);
+    PhaseEnd(PHASE_SYMBOLS, symbolScope, symbols->symbolCount + symbols->lineCount);
+  }
+  //note which words each file loaded, the caller reports overlaps if it keeps the map
+  LoadMap own = { 0 };
+  LoadMap* map = loads ? loads : &own;
+  for (int i = 0; i < count && result == 0 && (loads || count > 1); i++) {
+    result = AddToLoadMap(map, jobs[i].filename, &jobs[i].sections);
+  }
+  if (result == 0 && loads == NULL) {
+    ReportLoadOverlaps(&own, 0, NULL);
+  }
+  FreeLoadMap(&own);
+
+  for (int i = 0; i < count; i++) {
+    if (jobs[i].mapped) {
+      munmap(jobs[i].data, jobs[i].size);
+    } else {
+      free(jobs[i].data);
+    }
+    free(jobs[i].sections.sections);
+  }
+  free(jobs);
+  PhaseEnd(PHASE_LOAD, scope, count);
+  return result;
+}
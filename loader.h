@@ -2,8 +2,83 @@
  * loader.h: Declares loader functions for opening and loading object files
  */
 
+#ifndef LOADER_H
+#define LOADER_H
+
 #include <stdio.h>
+#include <stdint.h>
 #include "LC4.h"
+#include "symbols.h"
+
+// Most threads LoadObjectFiles parses on besides the calling one
+#define LOADER_MAX_THREADS 15
+
+// One CODE or DATA section of an object file, its words still big endian as in the file
+typedef struct {
+  uint16_t address;
+  uint16_t count;
+  const unsigned char* words;
+} ObjectSection;
+
+// The sections of one object file, in file order
+typedef struct {
+  ObjectSection* sections;
+  int count;
+  int capacity;
+} ObjectSections;
+
+// Words of memory, one bit each, in a load map
+#define LOAD_MAP_WORDS (65536 / 64)
+
+// The words each file loaded into one machine, in load order, for reporting where files overlap
+typedef struct {
+  char** names;
+  uint64_t* loads;
+  int count;
+  int capacity;
+} LoadMap;
+
+// Read an object file and modify the machine state as described in the writeup.
+// Regular files are memory mapped and parsed in place, anything else (e.g. a pipe) is read through stdio.
+// The filename "-" reads standard input
+int ReadObjectFile(char* filename, MachineState* CPU);
+
+// Load an object file already held in memory (size bytes at data)
+int LoadObjectBuffer(const unsigned char* data, size_t size, MachineState* CPU);
+
+// Read an object file from an open stream up to its end, the stream stays open
+int ReadObjectStream(FILE* file, MachineState* CPU);
+
+// Append the sections of an object file held in memory to list (they point into data)
+int ParseObjectSections(const unsigned char* data, size_t size, ObjectSections* list);
+
+// Add the labels, source files and line numbers of an object file held in memory to table
+// (line file indices are made relative to the table). The file must have parsed cleanly
+int ParseObjectSymbols(const unsigned char* data, size_t size, SymbolTable* table);
+
+// Copy parsed sections into memory, in order
+void ApplyObjectSections(const ObjectSections* list, MachineState* CPU);
+
+// Load several object files ("-" is standard input): they are parsed concurrently and
+// copied into memory in order, so later files win where they overlap. Unless symbols is
+// NULL their labels and line numbers are added to it, and it is sorted for lookups.
+// Unless loads is NULL the files are added to it for the caller to report; otherwise every
+// overlap between two of them is reported here
+int LoadObjectFiles(char** files, int count, MachineState* CPU, SymbolTable* symbols, LoadMap* loads);
+
+// Add a file loaded after the ones already in loads (name is copied), returns 0 on success
+int AddToLoadMap(LoadMap* loads, const char* name, const ObjectSections* list);
+
+// Add every file of src to loads, returns 0 on success
+int CopyLoadMap(LoadMap* loads, const LoadMap* src);
+
+// Warn on stderr about every span two files both load, naming the file whose words are kept
+// (a third, later file may win over both). Pairs of files that both come before file first
+// are left out, they were reported when those files were loaded. Unless label is NULL it
+// starts every warning
+void ReportLoadOverlaps(const LoadMap* loads, int first, const char* label);
+
+// Free what a load map holds, leaving it empty
+void FreeLoadMap(LoadMap* loads);
 
-// Read an object file and modify the machine state as described in the writeup
-int ReadObjectFile(char* filename, MachineState* CPU);
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+/*
+ * memdump.c: Defines the memory dump written after a run
+ */
+
+#include "memdump.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char hexDigits[16] = "0123456789ABCDEF";
+
+//helper function to render the dump line of one word, matching
+//fprintf("address: %05d contents: 0x%04X\n")
+static inline void formatDumpLine(char* dst, unsigned int address, unsigned short value) {
+    memcpy(dst, "address: ", 9);
+    dst[9] = '0' + address / 10000;
+    dst[10] = '0' + address / 1000 % 10;
+    dst[11] = '0' + address / 100 % 10;
+    dst[12] = '0' + address / 10 % 10;
+    dst[13] = '0' + address % 10;
+    memcpy(dst + 14, " contents: 0x", 13);
+    dst[27] = hexDigits[value >> 12];
+    dst[28] = hexDigits[(value >> 8) & 0xF];
+    dst[29] = hexDigits[(value >> 4) & 0xF];
+    dst[30] = hexDigits[value & 0xF];
+    dst[31] = '\n';
+}
+
+/*
+ * Write one line for every nonzero word of memory, in address order.
+ */
+int WriteMemoryDump(FILE* file, const MachineState* CPU) {
+    char* buffer = malloc(DUMP_BUFFER_SIZE);
+    if (buffer == NULL) {
+        return -1;
+    }
+    size_t used = 0;
+    int failed = 0;
+    for (int page = 0; page < MEMORY_PAGE_COUNT; page++) {
+        if (!PageWritten(CPU, page)) {
+            continue;
+        }
+        const unsigned short* words = CPU->memory + page * MEMORY_PAGE_WORDS;
+        //eight words at a time: bit pairs of the mask are set for words equal to zero
+        for (int i = 0; i < MEMORY_PAGE_WORDS; i += 8) {
+#ifdef __SSE2__
+            __m128i zero = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(words + i)), _mm_setzero_si128());
+            unsigned int nonzero = ~_mm_movemask_epi8(zero) & 0xFFFF;
+#else
+            unsigned int nonzero = 0;
+            for (int j = 0; j < 8; j++) {
+                nonzero |= (words[i + j] != 0) * (3u << (2 * j));
+            }
+#endif
+            while (nonzero) {
+                int j = __builtin_ctz(nonzero) / 2;
+                nonzero &= ~(3u << (2 * j));
+                if (DUMP_BUFFER_SIZE - used < DUMP_LINE_LENGTH) {
+                    failed |= fwrite(buffer, 1, used, file) != used;
+                    used = 0;
+                }
+                formatDumpLine(buffer + used, page * MEMORY_PAGE_WORDS + i + j, words[i + j]);
+                used += DUMP_LINE_LENGTH;
+            }
+        }
+    }
+    failed |= fwrite(buffer, 1, used, file) != used;
+    free(buffer);
+    return failed ? -1 : 0;
+}
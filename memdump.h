@@ -0,0 +1,23 @@
+/*
+ * memdump.h: Declares the memory dump written after a run
+ */
+
+#ifndef MEMDUMP_H
+#define MEMDUMP_H
+
+#include "LC4.h"
+
+// Every dump line has the same width: "address: DDDDD contents: 0xHHHH\n"
+#define DUMP_LINE_LENGTH 32
+
+// Size of the buffer dump lines are rendered into before each write
+#define DUMP_BUFFER_SIZE (1 << 16)
+
+
+/*
+ * Write one line for every nonzero word of memory, in address order,
+ * returns 0 on success. Only pages marked written are scanned.
+ */
+int WriteMemoryDump(FILE* file, const MachineState* CPU);
+
+#endif
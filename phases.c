@@ -0,0 +1,118 @@
+/*
+ * phases.c: Defines the host-side timers that break a run down into phases
+ */
+
+#include <string.h>
+#include "phases.h"
+
+#include <pthread.h>
+
+int PhaseTiming = 0;
+uint64_t PhaseOverheadTicks = 0;
+_Thread_local PhaseCounter ThreadPhases[PHASE_COUNT];
+_Thread_local uint64_t PhaseNestedTicks = 0;
+
+// totals of the threads merged so far
+static PhaseCounter phases[PHASE_COUNT];
+static pthread_mutex_t phasesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* phaseNames[PHASE_COUNT] = {
+    [PHASE_LOAD] = "load",
+    [PHASE_PARSE] = "parse",
+    [PHASE_APPLY] = "apply",
+    [PHASE_SYMBOLS] = "symbols",
+    [PHASE_CACHE] = "cache",
+    [PHASE_RESTORE] = "restore",
+    [PHASE_EXECUTE] = "execute",
+    [PHASE_DECODE] = "decode",
+    [PHASE_FORMAT] = "format",
+    [PHASE_WRITE] = "write",
+    [PHASE_CHECKPOINT] = "checkpoint",
+    [PHASE_REPORT] = "report",
+    [PHASE_DUMP] = "dump",
+};
+
+// when timing started, on the steady clock and in ticks
+static struct timespec startTime;
+static uint64_t startTicks;
+
+//helper function to get the wall time since timing started, and how long a tick is
+static uint64_t elapsedNanos(double* nanosPerTick) {
+    struct timespec now;
+    uint64_t ticks = PhaseTicks();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t nanos = (now.tv_sec - startTime.tv_sec) * 1000000000ull + (now.tv_nsec - startTime.tv_nsec);
+    //calibrate the ticks against the steady clock over the whole run
+    *nanosPerTick = ticks > startTicks ? (double)nanos / (ticks - startTicks) : 1.0;
+    return nanos;
+}
+
+/*
+ * Add the phases of the calling thread to the totals.
+ */
+void MergeThreadPhases(void) {
+    if (!PhaseTiming) {
+        return;
+    }
+    pthread_mutex_lock(&phasesLock);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        phases[p].ticks += ThreadPhases[p].ticks;
+        phases[p].calls += ThreadPhases[p].calls;
+        phases[p].items += ThreadPhases[p].items;
+    }
+    pthread_mutex_unlock(&phasesLock);
+    memset(ThreadPhases, 0, sizeof(ThreadPhases));
+}
+
+/*
+ * Turn timing on.
+ */
+void StartPhaseTiming(void) {
+    //the cheapest of many back to back reads is what an empty scope measures
+    PhaseOverheadTicks = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = PhaseTicks();
+        uint64_t ticks = PhaseTicks() - start;
+        PhaseOverheadTicks = ticks < PhaseOverheadTicks ? ticks : PhaseOverheadTicks;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    startTicks = PhaseTicks();
+    PhaseTiming = 1;
+}
+
+/*
+ * Print a table of the phases.
+ */
+void WritePhaseSummary(FILE* file) {
+    double nanosPerTick;
+    uint64_t wall = elapsedNanos(&nanosPerTick);
+    MergeThreadPhases();
+    fprintf(file, "%-12s %10s %14s %12s %7s\n", "phase", "calls", "items", "ms", "wall");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        uint64_t calls = phases[p].calls;
+        if (calls == 0) {
+            continue;
+        }
+        double nanos = phases[p].ticks * nanosPerTick;
+        fprintf(file, "%-12s %10llu %14llu %12.3f %6.1f%%\n", phaseNames[p], (unsigned long long)calls,
+                (unsigned long long)phases[p].items, nanos / 1e6, wall ? 100.0 * nanos / wall : 0.0);
+    }
+    fprintf(file, "%-12s %10s %14s %12.3f\n", "total", "", "", wall / 1e6);
+}
+
+/*
+ * Write the phases as a JSON object.
+ */
+int WritePhaseJson(FILE* file) {
+    double nanosPerTick;
+    uint64_t wall = elapsedNanos(&nanosPerTick);
+    MergeThreadPhases();
+    fprintf(file, "{\n  \"wall_ns\": %llu,\n  \"phases\": {", (unsigned long long)wall);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        fprintf(file, "%s\n    \"%s\": { \"calls\": %llu, \"items\": %llu, \"ns\": %.0f }", p ? "," : "",
+                phaseNames[p], (unsigned long long)phases[p].calls, (unsigned long long)phases[p].items,
+                phases[p].ticks * nanosPerTick);
+    }
+    fprintf(file, "\n  }\n}\n");
+    return ferror(file) ? -1 : 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * phases.h: Declares the host-side timers that break a run down into phases
+ *
+ * Loading, decoding, execution, trace formatting and writing, checkpoints and
+ * the memory dump each have a phase. Code of a phase is wrapped in a scope:
+ *
+ *   PhaseScope scope = PhaseBegin();
+ *   ...
+ *   PhaseEnd(PHASE_DECODE, scope, 1);
+ *
+ * Scopes nest, and a phase is only charged the time not spent in scopes
+ * nested inside it, so the phases of one thread add up to its wall time.
+ * Each thread adds up its phases privately and merges them into the totals
+ * when it finishes, so threads (loader, trace writers) are summed.
+ * Timing is off until StartPhaseTiming, and costs one untaken branch per
+ * scope until then. Ticks come from the TSC where there is one, else from
+ * the steady clock.
+ */
+
+#ifndef PHASES_H
+#define PHASES_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// One in how many trace records the threaded engine times
+#define PHASE_SAMPLE_EVERY 64
+
+enum {
+    PHASE_LOAD,         // obj file reads, waiting for the parse threads
+    PHASE_PARSE,        // finding the sections of obj files
+    PHASE_APPLY,        // copying sections into memory
+    PHASE_SYMBOLS,      // collecting labels and line numbers
+    PHASE_CACHE,        // image cache hashing, restores and saves
+    PHASE_RESTORE,      // restoring a checkpoint
+    PHASE_EXECUTE,      // running the machine, minus the phases below
+    PHASE_DECODE,       // predecoding instructions
+    PHASE_FORMAT,       // rendering (or queueing) trace records
+    PHASE_WRITE,        // writing the trace file
+    PHASE_CHECKPOINT,   // writing checkpoints
+    PHASE_REPORT,       // profiles and statistics
+    PHASE_DUMP,         // the memory dump
+    PHASE_COUNT
+};
+
+typedef struct {
+    uint64_t ticks;
+    uint64_t calls;
+    // what a phase counts: files, bytes, words, cycles or instructions
+    uint64_t items;
+} PhaseCounter;
+
+typedef struct {
+    uint64_t start;
+    uint64_t nested;
+} PhaseScope;
+
+extern int PhaseTiming;
+// what reading the clock itself adds to a scope, measured by StartPhaseTiming
+extern uint64_t PhaseOverheadTicks;
+// this thread's phases, not merged yet
+extern _Thread_local PhaseCounter ThreadPhases[PHASE_COUNT];
+// ticks spent in finished scopes on this thread, for charging enclosing scopes only their own time
+extern _Thread_local uint64_t PhaseNestedTicks;
+
+
+static inline uint64_t PhaseTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+
+/*
+ * Open a scope, a no-op while timing is off.
+ */
+static inline PhaseScope PhaseBegin(void) {
+    PhaseScope scope = { 0, 0 };
+    if (PhaseTiming) {
+        scope.start = PhaseTicks();
+        scope.nested = PhaseNestedTicks;
+    }
+    return scope;
+}
+
+
+/*
+ * Close a scope, charging phase its time minus that of the scopes inside it
+ * and adding items to what it counted.
+ */
+static inline void PhaseEnd(int phase, PhaseScope scope, uint64_t items) {
+    if (PhaseTiming) {
+        uint64_t elapsed = PhaseTicks() - scope.start;
+        elapsed = elapsed > PhaseOverheadTicks ? elapsed - PhaseOverheadTicks : 0;
+        uint64_t inner = PhaseNestedTicks - scope.nested;
+        inner = inner < elapsed ? inner : elapsed;
+        PhaseNestedTicks += elapsed - inner;
+        ThreadPhases[phase].ticks += elapsed - inner;
+        ThreadPhases[phase].calls++;
+        ThreadPhases[phase].items += items;
+    }
+}
+
+
+/*
+ * Close a scope timed for only one in every weight calls, charging phase
+ * weight times its time and items. For per cycle work, where timing every
+ * call would cost as much as the work itself.
+ */
+static inline void PhaseEndSampled(int phase, PhaseScope scope, uint64_t items, uint64_t weight) {
+    if (PhaseTiming) {
+        uint64_t elapsed = PhaseTicks() - scope.start;
+        elapsed = elapsed > PhaseOverheadTicks ? elapsed - PhaseOverheadTicks : 0;
+        uint64_t inner = PhaseNestedTicks - scope.nested;
+        uint64_t own = (inner < elapsed ? elapsed - inner : 0) * weight;
+        //enclosing scopes are charged the estimate, not just the sampled call
+        PhaseNestedTicks = scope.nested + (inner < elapsed ? inner : elapsed) + own;
+        ThreadPhases[phase].ticks += own;
+        ThreadPhases[phase].calls += weight;
+        ThreadPhases[phase].items += items * weight;
+    }
+}
+
+
+/*
+ * Add the phases of the calling thread to the totals, every thread that
+ * opens scopes calls this before it exits.
+ */
+void MergeThreadPhases(void);
+
+
+/*
+ * Turn timing on, the wall clock of the summary starts here.
+ */
+void StartPhaseTiming(void);
+
+
+/*
+ * Print a table of the phases (calls, items, milliseconds and share of the
+ * wall time since StartPhaseTiming) to file. Merges the calling thread.
+ */
+void WritePhaseSummary(FILE* file);
+
+
+/*
+ * Write the same numbers as a JSON object, with times in nanoseconds, for
+ * comparing runs across releases. Returns 0 on success.
+ */
+int WritePhaseJson(FILE* file);
+
+#endif
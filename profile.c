@@ -0,0 +1,214 @@
+/*
+ * profile.c: Defines the guest profiler fed by the threaded engine
+ */
+
+#include <stdlib.h>
+#include "profile.h"
+
+const unsigned char ProfileEffect[OP_COUNT] = {
+    [OP_JSR] = PROFILE_CALL,
+    [OP_JSRR] = PROFILE_CALL,
+    [OP_TRAP] = PROFILE_CALL,
+    [OP_RTI] = PROFILE_RETURN,
+    [OP_JMPR] = PROFILE_RETURN,
+};
+
+//helper function to add a frame to the call tree, returns its index or -1 if out of memory
+static int addFrame(Profile* profile, unsigned short entry, int parent) {
+    if (profile->frameCount == profile->frameCapacity) {
+        int capacity = profile->frameCapacity ? 2 * profile->frameCapacity : 256;
+        ProfileFrame* frames = realloc(profile->frames, capacity * sizeof(ProfileFrame));
+        if (frames == NULL) {
+            return -1;
+        }
+        profile->frames = frames;
+        profile->frameCapacity = capacity;
+    }
+    int index = profile->frameCount++;
+    ProfileFrame* frame = &profile->frames[index];
+    frame->entry = entry;
+    frame->parent = parent;
+    frame->firstChild = -1;
+    frame->nextSibling = -1;
+    frame->depth = parent < 0 ? 0 : profile->frames[parent].depth + 1;
+    frame->cycles = 0;
+    if (parent >= 0) {
+        frame->nextSibling = profile->frames[parent].firstChild;
+        profile->frames[parent].firstChild = index;
+    }
+    return index;
+}
+
+/*
+ * Create an empty profile for a run starting at entry.
+ */
+Profile* CreateProfile(unsigned short entry) {
+    Profile* profile = calloc(1, sizeof(Profile));
+    if (profile == NULL) {
+        return NULL;
+    }
+    if (addFrame(profile, entry, -1) != 0) {
+        free(profile);
+        return NULL;
+    }
+    return profile;
+}
+
+/*
+ * Push (or find) the frame for a call to target.
+ */
+void ProfileCall(Profile* profile, unsigned short target) {
+    if (profile->frames[profile->current].depth >= PROFILE_MAX_DEPTH) {
+        profile->truncatedCalls++;
+        profile->untrackedCalls++;
+        return;
+    }
+    int child = profile->frames[profile->current].firstChild;
+    while (child >= 0 && profile->frames[child].entry != target) {
+        child = profile->frames[child].nextSibling;
+    }
+    if (child < 0) {
+        child = addFrame(profile, target, profile->current);
+        if (child < 0) {
+            profile->truncatedCalls++;
+            profile->untrackedCalls++;
+            return;
+        }
+    }
+    profile->current = child;
+}
+
+// A count and what it counts, for ranking
+typedef struct {
+    uint64_t count;
+    int index;
+} RankEntry;
+
+//helper function to order ranked counts largest first, ties by index
+static int compareRank(const void* a, const void* b) {
+    const RankEntry* x = a;
+    const RankEntry* y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : x->index - y->index;
+}
+
+//helper function to sort the nonzero counts in order, returns how many there are
+static int rank(const uint64_t* counts, int size, RankEntry* order) {
+    int n = 0;
+    for (int i = 0; i < size; i++) {
+        if (counts[i]) {
+            order[n++] = (RankEntry){ counts[i], i };
+        }
+    }
+    qsort(order, n, sizeof(RankEntry), compareRank);
+    return n;
+}
+
+//helper function to print an address of the report, with its label and source line when known
+static void printPlace(const SymbolTable* symbols, int address, FILE* report) {
+    char name[64] = "";
+    char place[128];
+    const char* file = NULL;
+    uint16_t offset;
+    int line = symbols ? FindLine(symbols, address, &file) : 0;
+    //without a label FormatAddress would only repeat the address
+    if (symbols && FindSymbol(symbols, address, &offset)) {
+        FormatAddress(symbols, address, name, sizeof(name));
+    }
+    if (line) {
+        snprintf(place, sizeof(place), "%s%s(%s:%d)", name, name[0] ? " " : "", file ? file : "?", line);
+    } else {
+        snprintf(place, sizeof(place), "%s", name);
+    }
+    fprintf(report, "  x%04X %-40s", address, place);
+}
+
+//helper function to print a frame's stack as folded frame names, root first
+static void printStack(const Profile* profile, const SymbolTable* symbols, int frame, FILE* folded) {
+    char name[64];
+    if (profile->frames[frame].parent >= 0) {
+        printStack(profile, symbols, profile->frames[frame].parent, folded);
+        fputc(';', folded);
+    }
+    fputs(FormatAddress(symbols, profile->frames[frame].entry, name, sizeof(name)), folded);
+}
+
+/*
+ * Write the report and the folded call stacks.
+ */
+int WriteProfile(const Profile* profile, const SymbolTable* symbols, FILE* report, FILE* folded) {
+    RankEntry* order = malloc(65536 * sizeof(RankEntry));
+    uint64_t* selfCycles = calloc(65536, sizeof(uint64_t));
+    if (order == NULL || selfCycles == NULL) {
+        free(order);
+        free(selfCycles);
+        return -1;
+    }
+    uint64_t total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += profile->opCounts[op];
+    }
+    double percent = total ? 100.0 / total : 0;
+    fprintf(report, "%llu cycles\n", (unsigned long long)total);
+
+    //operation histogram
+    fprintf(report, "\noperations\n");
+    int n = rank(profile->opCounts, OP_COUNT, order);
+    for (int i = 0; i < n; i++) {
+        fprintf(report, "  %-8s %12llu %6.2f%%\n", OpName(order[i].index),
+                (unsigned long long)profile->opCounts[order[i].index], profile->opCounts[order[i].index] * percent);
+    }
+
+    //hottest PCs
+    fprintf(report, "\nhottest PCs\n");
+    n = rank(profile->pcCounts, 65536, order);
+    for (int i = 0; i < n && i < PROFILE_REPORT_TOP; i++) {
+        printPlace(symbols, order[i].index, report);
+        fprintf(report, " %12llu %6.2f%%\n", (unsigned long long)profile->pcCounts[order[i].index],
+                profile->pcCounts[order[i].index] * percent);
+    }
+
+    //branches, ranked by how often they ran
+    fprintf(report, "\nbranches (executed, taken)\n");
+    n = rank(profile->branches, 65536, order);
+    for (int i = 0; i < n && i < PROFILE_REPORT_TOP; i++) {
+        int pc = order[i].index;
+        printPlace(symbols, pc, report);
+        fprintf(report, " %12llu %12llu %6.2f%% taken\n", (unsigned long long)profile->branches[pc],
+                (unsigned long long)profile->taken[pc], 100.0 * profile->taken[pc] / profile->branches[pc]);
+    }
+
+    //subroutines by the cycles spent in their own code
+    fprintf(report, "\nsubroutines (self cycles)\n");
+    for (int f = 0; f < profile->frameCount; f++) {
+        selfCycles[profile->frames[f].entry] += profile->frames[f].cycles;
+    }
+    n = rank(selfCycles, 65536, order);
+    for (int i = 0; i < n && i < PROFILE_REPORT_TOP; i++) {
+        printPlace(symbols, order[i].index, report);
+        fprintf(report, " %12llu %6.2f%%\n", (unsigned long long)selfCycles[order[i].index], selfCycles[order[i].index] * percent);
+    }
+    if (profile->truncatedCalls) {
+        fprintf(report, "\n%llu calls past depth %d were not tracked\n",
+                (unsigned long long)profile->truncatedCalls, PROFILE_MAX_DEPTH);
+    }
+
+    //one folded line per stack that ran any cycles
+    for (int f = 0; f < profile->frameCount; f++) {
+        if (profile->frames[f].cycles) {
+            printStack(profile, symbols, f, folded);
+            fprintf(folded, " %llu\n", (unsigned long long)profile->frames[f].cycles);
+        }
+    }
+
+    free(order);
+    free(selfCycles);
+    return ferror(report) || ferror(folded) ? -1 : 0;
+}
+
+/*
+ * Free the profile.
+ */
+void FreeProfile(Profile* profile) {
+    free(profile->frames);
+    free(profile);
+}
@@ -0,0 +1,121 @@
+/*
+ * profile.h: Declares the guest profiler fed by the threaded engine
+ *
+ * Every executed cycle is counted per PC and per operation, conditional
+ * branches count how often they were taken, and a shadow call stack follows
+ * JSR, JSRR and TRAP (push) and RTI or JMPR R7 (pop) so cycles can be charged
+ * to the chain of subroutines they ran in.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "LC4.h"
+#include "decode.h"
+#include "symbols.h"
+
+// Deepest shadow call stack kept, deeper calls are charged to the frame at this depth
+#define PROFILE_MAX_DEPTH 256
+
+// How many entries each ranking in the report lists
+#define PROFILE_REPORT_TOP 20
+
+// What an operation does to the shadow call stack
+enum {
+    PROFILE_STEP,
+    PROFILE_CALL,
+    PROFILE_RETURN
+};
+
+// One distinct call stack: a subroutine entered from its parent's stack
+typedef struct {
+    unsigned short entry;
+    int parent;
+    int firstChild;
+    int nextSibling;
+    int depth;
+    uint64_t cycles;
+} ProfileFrame;
+
+typedef struct {
+    uint64_t pcCounts[65536];
+    uint64_t branches[65536];
+    uint64_t taken[65536];
+    uint64_t opCounts[OP_COUNT];
+
+    // call tree, frame 0 is where the run started; current is the running stack
+    ProfileFrame* frames;
+    int frameCount;
+    int frameCapacity;
+    int current;
+
+    // calls deeper than PROFILE_MAX_DEPTH (or past running out of memory), not
+    // pushed, and how many of those have not returned yet: their returns must
+    // not pop a frame that was pushed
+    uint64_t truncatedCalls;
+    uint64_t untrackedCalls;
+} Profile;
+
+// PROFILE_ effect of every operation
+extern const unsigned char ProfileEffect[OP_COUNT];
+
+
+/*
+ * Create an empty profile for a run starting at entry, NULL if out of memory.
+ */
+Profile* CreateProfile(unsigned short entry);
+
+
+/*
+ * Push (or find) the frame for a call to target.
+ */
+void ProfileCall(Profile* profile, unsigned short target);
+
+
+/*
+ * Count a conditional branch at pc, taken or not.
+ */
+static inline void ProfileBranch(Profile* profile, unsigned short pc, int taken) {
+    profile->branches[pc]++;
+    profile->taken[pc] += taken != 0;
+}
+
+
+/*
+ * Count one cycle: the instruction at pc ran and moved the PC to newPC.
+ */
+static inline void ProfileCycle(Profile* profile, const DecodedInsn* insn, unsigned short pc, unsigned short newPC) {
+    profile->pcCounts[pc]++;
+    profile->opCounts[insn->op]++;
+    profile->frames[profile->current].cycles++;
+    unsigned char effect = ProfileEffect[insn->op];
+    if (effect == PROFILE_CALL) {
+        ProfileCall(profile, newPC);
+    } else if (effect == PROFILE_RETURN && (insn->op == OP_RTI || insn->rs == 7)) {
+        if (profile->untrackedCalls) {
+            profile->untrackedCalls--;
+        } else if (profile->current) {
+            profile->current = profile->frames[profile->current].parent;
+        }
+    }
+}
+
+
+/*
+ * Write the report (totals, operation histogram, hottest PCs, branches and
+ * subroutines) to report and the folded call stacks, one "frame;frame count"
+ * line per stack as flamegraph.pl expects, to folded. Addresses are named
+ * after the labels and source lines in symbols when it is not NULL.
+ * Returns 0 on success.
+ */
+int WriteProfile(const Profile* profile, const SymbolTable* symbols, FILE* report, FILE* folded);
+
+
+/*
+ * Free the profile.
+ */
+void FreeProfile(Profile* profile);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * sharedimage.c: Defines machine images shared copy-on-write between machines
+ */
+
+#define _GNU_SOURCE
+#include "sharedimage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Write a copy of CPU to a new shared image.
+ */
+SharedImage* CreateSharedImage(const MachineState* CPU) {
+#ifdef MFD_CLOEXEC
+    SharedImage* image = malloc(sizeof(SharedImage));
+    if (image == NULL) {
+        return NULL;
+    }
+    long pageSize = sysconf(_SC_PAGESIZE);
+    image->size = (sizeof(MachineState) + pageSize - 1) / pageSize * pageSize;
+    image->fd = memfd_create("lc4image", MFD_CLOEXEC);
+    if (image->fd < 0 || ftruncate(image->fd, image->size) != 0) {
+        perror("Error creating shared image");
+        FreeSharedImage(image);
+        return NULL;
+    }
+    //fill the file through a shared mapping, the decode cache belongs to the original only
+    MachineState* shared = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, 0);
+    if (shared == MAP_FAILED) {
+        perror("Error creating shared image");
+        FreeSharedImage(image);
+        return NULL;
+    }
+    memcpy(shared, CPU, sizeof(MachineState));
+    shared->decoded = NULL;
+    munmap(shared, image->size);
+    return image;
+#else
+    //no anonymous memory files here, callers copy the machine instead
+    (void)CPU;
+    return NULL;
+#endif
+}
+
+/*
+ * Map a new machine from the image.
+ */
+MachineState* MapSharedImage(const SharedImage* image) {
+    //private, so the machine's writes land in pages of its own and never reach the file
+    MachineState* CPU = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->fd, 0);
+    return CPU == MAP_FAILED ? NULL : CPU;
+}
+
+/*
+ * Unmap a machine mapped from image.
+ */
+void UnmapMachine(const SharedImage* image, MachineState* CPU) {
+    munmap(CPU, image->size);
+}
+
+/*
+ * Close the image.
+ */
+void FreeSharedImage(SharedImage* image) {
+    if (image->fd >= 0) {
+        close(image->fd);
+    }
+    free(image);
+}
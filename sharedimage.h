@@ -0,0 +1,49 @@
+/*
+ * sharedimage.h: Declares machine images shared copy-on-write between machines
+ *
+ * A loaded machine is written once into an anonymous memory file. Every
+ * machine mapped from it privately starts out as an exact copy, but shares
+ * the file's pages until it writes to them: the kernel copies a 4 KB page
+ * (2048 words) on its first write. A run that stores to a few pages of
+ * memory costs only those pages, while the OS code and data it only reads
+ * stay shared between all the machines.
+ */
+
+#ifndef SHAREDIMAGE_H
+#define SHAREDIMAGE_H
+
+#include <stddef.h>
+#include "LC4.h"
+
+typedef struct {
+    int fd;
+    // bytes mapped per machine, sizeof(MachineState) rounded up to whole pages
+    size_t size;
+} SharedImage;
+
+
+/*
+ * Write a copy of CPU (without its decode cache) to a new shared image.
+ * Returns NULL if the system cannot share memory this way.
+ */
+SharedImage* CreateSharedImage(const MachineState* CPU);
+
+
+/*
+ * Map a new machine from the image, NULL on failure. Free it with UnmapMachine.
+ */
+MachineState* MapSharedImage(const SharedImage* image);
+
+
+/*
+ * Unmap a machine mapped from image, after its decode cache has been freed.
+ */
+void UnmapMachine(const SharedImage* image, MachineState* CPU);
+
+
+/*
+ * Close the image. Machines mapped from it stay valid.
+ */
+void FreeSharedImage(SharedImage* image);
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ * sweep.c: Defines the lockstep engine that runs many machines at once
+ */
+
+#include "sweep.h"
+#include <stdlib.h>
+#include <string.h>
+
+// One register of 16 lanes, and the same read as signed values
+typedef uint16_t SweepWord __attribute__((vector_size(SWEEP_VECTOR_LANES * 2)));
+typedef int16_t SweepSigned __attribute__((vector_size(SWEEP_VECTOR_LANES * 2)));
+
+// The step loop is also compiled for AVX2 where the loader can pick the version the CPU
+// supports, elsewhere the same vector code is built for the baseline instruction set
+#if defined(__x86_64__) && defined(__linux__) && (defined(__clang__) ? __clang_major__ >= 14 : __GNUC__ >= 6)
+#define SWEEP_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SWEEP_CLONES
+#endif
+
+// The vector helpers are macros, so each version of the step loop compiles them for its own
+// instruction set (vector arguments to functions change with it)
+
+// a in the lanes where mask is set and b in the others
+#define PICK(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+// SetNZP's bits for every lane: each comparison yields 0 or all ones per lane
+#define NZP_OF(value) NZP_BITS((SweepWord)((SweepSigned)(value) < 0), (SweepWord)((value) == 0))
+#define NZP_BITS(negative, zero) (((negative) & 4) | ((zero) & 2) | (~((negative) | (zero)) & 1))
+
+//helper function to set SetNZP's bits for one lane
+static inline void setLaneNZP(Sweep* sweep, int lane, short result) {
+    unsigned short nzp = (result < 0) ? 4 : (result == 0) ? 2 : 1;
+    sweep->PSR[lane] = (sweep->PSR[lane] & 0xFFF8) | nzp;
+}
+
+//helper function to stop a lane of the group on a fault, its PC stays on the faulting instruction
+static inline void faultLane(Sweep* sweep, int lane) {
+    sweep->faulted[lane] = 1;
+    sweep->running[lane] = 0;
+    sweep->group[lane] = 0;
+}
+
+//helper function to decode the word at pc where lanes may differ: the group keeps the first lane
+//and the lanes holding the same word, the others run it in a later step
+static DecodedInsn fetchDivergent(Sweep* sweep, unsigned short pc) {
+    int leader = -1;
+    unsigned short word = 0;
+    for (int l = 0; l < sweep->lanes; l++) {
+        if (!sweep->group[l]) {
+            continue;
+        }
+        if (leader < 0) {
+            leader = l;
+            word = sweep->machines[l]->memory[pc];
+        } else if (sweep->machines[l]->memory[pc] != word) {
+            sweep->group[l] = 0;
+        }
+    }
+    DecodedInsn insn;
+    DecodeInsn(word, &insn);
+    if (!IsExecutableAddress(pc)) {
+        insn.op = OP_HALT;
+    }
+    return insn;
+}
+
+//helper function to decode the instruction the group runs, the same way DecodeAt does
+static inline DecodedInsn fetch(Sweep* sweep, unsigned short pc) {
+    if (sweep->divergent[pc]) {
+        return fetchDivergent(sweep, pc);
+    }
+    //every lane holds the same word here, lane 0's stands for all of them
+    DecodedInsn* insn = &sweep->decoded[pc];
+    if (insn->op == OP_UNDECODED) {
+        DecodeInsn(sweep->machines[0]->memory[pc], insn);
+        if (!IsExecutableAddress(pc)) {
+            insn->op = OP_HALT;
+        }
+    }
+    return *insn;
+}
+
+//helper function to run steps until no lane may run any more this round, returns the steps taken
+static SWEEP_CLONES uint64_t runRound(Sweep* sweep) {
+    int vectors = sweep->lanes / SWEEP_VECTOR_LANES;
+    SweepWord* PC = (SweepWord*)sweep->PC;
+    SweepWord* PSR = (SweepWord*)sweep->PSR;
+    SweepWord* running = (SweepWord*)sweep->running;
+    SweepWord* left = (SweepWord*)sweep->left;
+    SweepWord* group = (SweepWord*)sweep->group;
+    SweepWord* R[8];
+    for (int r = 0; r < 8; r++) {
+        R[r] = (SweepWord*)sweep->R[r];
+    }
+    uint64_t steps = 0;
+
+// every vector of lanes, v being its index
+#define EACH_VECTOR for (int v = 0; v < vectors; v++)
+
+// the lanes of the group one at a time, l being the lane, for what has no vector form
+#define EACH_LANE for (int l = 0; l < sweep->lanes; l++) if (sweep->group[l])
+
+// a value in every lane
+#define ALL(value) ((SweepWord){ 0 } + (uint16_t)(value))
+
+// set the NZP bits of the group's lanes from result
+#define SET_NZP(bits) do { \
+        PSR[v] = PICK(group[v], (PSR[v] & 0xFFF8) | (bits), PSR[v]); \
+    } while (0)
+
+// write a register of the group's lanes and set their NZP bits from it
+#define WRITE(reg, value) do { \
+        SweepWord written = (value); \
+        (reg)[v] = PICK(group[v], written, (reg)[v]); \
+        SET_NZP(NZP_OF(written)); \
+    } while (0)
+
+    while (1) {
+        //the lowest PC of a lane that may run goes next, so lanes that went apart meet again there
+        SweepWord lowest = ~ALL(0);
+        SweepWord ready = ALL(0);
+        EACH_VECTOR {
+            SweepWord mayRun = running[v] & (SweepWord)(left[v] != 0);
+            SweepWord candidate = PICK(mayRun, PC[v], lowest);
+            lowest = PICK((SweepWord)(candidate < lowest), candidate, lowest);
+            ready |= mayRun;
+        }
+        unsigned short pc = 0xFFFF;
+        int anyReady = 0;
+        for (int i = 0; i < SWEEP_VECTOR_LANES; i++) {
+            pc = lowest[i] < pc ? lowest[i] : pc;
+            anyReady |= ready[i];
+        }
+        if (!anyReady) {
+            break;
+        }
+        EACH_VECTOR {
+            group[v] = running[v] & (SweepWord)(left[v] != 0) & (SweepWord)(PC[v] == pc);
+        }
+        steps++;
+
+        DecodedInsn insn = fetch(sweep, pc);
+        int rd = insn.rd;
+        int rs = insn.rs;
+        int rt = insn.rt;
+        //where the group goes next, -1 when each lane has its own target
+        int next = (unsigned short)(pc + 1);
+        switch (insn.op) {
+            case OP_BR: {
+                EACH_VECTOR {
+                    SweepWord taken = (SweepWord)((PSR[v] & (rd & 0x7)) != 0);
+                    PC[v] = PICK(group[v], ALL(pc + 1) + (taken & ALL(insn.imm)), PC[v]);
+                }
+                next = -1;
+                break;
+            }
+            case OP_ADD: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] + R[rt][v]);
+                break;
+            }
+            case OP_MUL: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] * R[rt][v]);
+                break;
+            }
+            case OP_SUB: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] - R[rt][v]);
+                break;
+            }
+            case OP_DIV: {
+                EACH_LANE {
+                    if (sweep->R[rt][l] == 0) {
+                        faultLane(sweep, l);
+                        continue;
+                    }
+                    int ans = (short)sweep->R[rs][l] / (short)sweep->R[rt][l];
+                    setLaneNZP(sweep, l, ans);
+                    sweep->R[rd][l] = ans;
+                }
+                break;
+            }
+            case OP_ADDI: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] + ALL(insn.imm));
+                break;
+            }
+            case OP_CMP:
+            case OP_CMPU: {
+                //signed or not, ComparativeOp takes the NZP of the difference wrapped to 16 bits
+                EACH_VECTOR SET_NZP(NZP_OF((SweepWord)(R[rs][v] - R[rt][v])));
+                break;
+            }
+            case OP_CMPI:
+            case OP_CMPIU: {
+                EACH_VECTOR SET_NZP(NZP_OF(R[rs][v] - ALL(insn.imm)));
+                break;
+            }
+            case OP_JSRR: {
+                EACH_VECTOR WRITE(R[7], ALL(pc + 1));
+                next = rs;
+                break;
+            }
+            case OP_JSR: {
+                EACH_VECTOR WRITE(R[7], ALL(pc + 1));
+                next = (unsigned short)((pc & 0x8000) | (insn.imm << 4));
+                break;
+            }
+            case OP_AND: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] & R[rt][v]);
+                break;
+            }
+            case OP_NOT: {
+                EACH_VECTOR WRITE(R[rd], ~R[rs][v]);
+                break;
+            }
+            case OP_OR: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] | R[rt][v]);
+                break;
+            }
+            case OP_XOR: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] ^ R[rt][v]);
+                break;
+            }
+            case OP_ANDI: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] & ALL(insn.imm));
+                break;
+            }
+            case OP_LDR: {
+                EACH_LANE {
+                    unsigned short memAddress = sweep->R[rs][l] + insn.imm;
+                    if (BadDataAddress(sweep->PSR[l], memAddress) || rs == rd) {
+                        faultLane(sweep, l);
+                        continue;
+                    }
+                    sweep->R[rd][l] = sweep->machines[l]->memory[memAddress];
+                    setLaneNZP(sweep, l, sweep->R[rd][l]);
+                }
+                break;
+            }
+            case OP_STR: {
+                EACH_LANE {
+                    unsigned short memAddress = sweep->R[rs][l] + insn.imm;
+                    if (BadDataAddress(sweep->PSR[l], memAddress) || rs == rt) {
+                        faultLane(sweep, l);
+                        continue;
+                    }
+                    MachineState* lane = sweep->machines[l];
+                    lane->memory[memAddress] = sweep->R[rt][l];
+                    MarkWritten(lane, memAddress);
+                    //the lanes may not agree on this word any more, should it be run
+                    if (IsExecutableAddress(memAddress)) {
+                        sweep->divergent[memAddress] = 1;
+                    }
+                }
+                break;
+            }
+            case OP_RTI: {
+                EACH_VECTOR {
+                    PC[v] = PICK(group[v], R[7][v], PC[v]);
+                }
+                next = -1;
+                break;
+            }
+            case OP_CONST: {
+                EACH_VECTOR WRITE(R[rd], ALL(insn.imm));
+                break;
+            }
+            case OP_SLL:
+            case OP_SRA: {
+                //ShiftModOp shifts SRA left as well, kept so every engine agrees
+                EACH_VECTOR WRITE(R[rd], R[rs][v] << insn.imm);
+                break;
+            }
+            case OP_SRL: {
+                EACH_VECTOR WRITE(R[rd], R[rs][v] >> insn.imm);
+                break;
+            }
+            case OP_MOD: {
+                EACH_LANE {
+                    if (sweep->R[rt][l] == 0) {
+                        faultLane(sweep, l);
+                        continue;
+                    }
+                    sweep->R[rd][l] = sweep->R[rs][l] % sweep->R[rt][l];
+                    setLaneNZP(sweep, l, sweep->R[rd][l]);
+                }
+                break;
+            }
+            case OP_JMPR: {
+                next = rs;
+                break;
+            }
+            case OP_JMP: {
+                next = (unsigned short)((pc & 0x8000) | (insn.imm << 4));
+                break;
+            }
+            case OP_HICONST: {
+                EACH_VECTOR WRITE(R[rd], (R[rd][v] & 0x0FF) | ALL(insn.imm << 8));
+                break;
+            }
+            case OP_TRAP: {
+                EACH_VECTOR {
+                    WRITE(R[7], ALL(pc + 1));
+                    PSR[v] |= group[v] & 0x8000;
+                }
+                next = 0x8000 | insn.imm;
+                break;
+            }
+            case OP_BADHICONST: {
+                EACH_LANE {
+                    faultLane(sweep, l);
+                }
+                continue;
+            }
+            default: {
+                //OP_ILLEGAL and OP_HALT stop the group where it is, without counting the cycle
+                EACH_VECTOR {
+                    running[v] &= ~group[v];
+                }
+                continue;
+            }
+        }
+
+        //the group's lanes (less any that faulted) finished the cycle
+        EACH_VECTOR {
+            if (next >= 0) {
+                PC[v] = PICK(group[v], ALL(next), PC[v]);
+            }
+            left[v] -= group[v] & 1;
+        }
+    }
+    return steps;
+
+#undef EACH_VECTOR
+#undef EACH_LANE
+#undef ALL
+#undef SET_NZP
+#undef WRITE
+}
+
+//helper function to allocate a register for every lane, aligned for vector access
+static uint16_t* allocLanes(int lanes) {
+    uint16_t* words = aligned_alloc(SWEEP_VECTOR_LANES * 2, lanes * sizeof(uint16_t));
+    if (words) {
+        memset(words, 0, lanes * sizeof(uint16_t));
+    }
+    return words;
+}
+
+/*
+ * Create a sweep over count loaded machines.
+ */
+Sweep* CreateSweep(MachineState** machines, int count) {
+    Sweep* sweep = calloc(1, sizeof(Sweep));
+    if (sweep == NULL || count < 1) {
+        free(sweep);
+        return NULL;
+    }
+    sweep->laneCount = count;
+    sweep->lanes = (count + SWEEP_VECTOR_LANES - 1) / SWEEP_VECTOR_LANES * SWEEP_VECTOR_LANES;
+    sweep->machines = machines;
+    int failed = (sweep->PC = allocLanes(sweep->lanes)) == NULL;
+    failed |= (sweep->PSR = allocLanes(sweep->lanes)) == NULL;
+    for (int r = 0; r < 8; r++) {
+        failed |= (sweep->R[r] = allocLanes(sweep->lanes)) == NULL;
+    }
+    failed |= (sweep->running = allocLanes(sweep->lanes)) == NULL;
+    failed |= (sweep->left = allocLanes(sweep->lanes)) == NULL;
+    failed |= (sweep->budget = allocLanes(sweep->lanes)) == NULL;
+    failed |= (sweep->group = allocLanes(sweep->lanes)) == NULL;
+    failed |= (sweep->faulted = calloc(sweep->lanes, 1)) == NULL;
+    failed |= (sweep->cycles = calloc(sweep->lanes, sizeof(uint64_t))) == NULL;
+    failed |= (sweep->decoded = calloc(65536, sizeof(DecodedInsn))) == NULL;
+    failed |= (sweep->divergent = calloc(65536, 1)) == NULL;
+    if (failed) {
+        FreeSweep(sweep);
+        return NULL;
+    }
+
+    //take the registers, the padding lanes never run
+    for (int l = 0; l < count; l++) {
+        sweep->PC[l] = machines[l]->PC;
+        sweep->PSR[l] = machines[l]->PSR;
+        for (int r = 0; r < 8; r++) {
+            sweep->R[r][l] = machines[l]->R[r];
+        }
+        sweep->running[l] = 0xFFFF;
+    }
+
+    //find the code the lanes were loaded with differently, a page at a time
+    for (int page = 0; page < MEMORY_PAGE_COUNT; page++) {
+        const unsigned short* first = machines[0]->memory + page * MEMORY_PAGE_WORDS;
+        for (int l = 1; l < count; l++) {
+            const unsigned short* words = machines[l]->memory + page * MEMORY_PAGE_WORDS;
+            if (memcmp(words, first, MEMORY_PAGE_WORDS * sizeof(unsigned short)) == 0) {
+                continue;
+            }
+            for (int i = 0; i < MEMORY_PAGE_WORDS; i++) {
+                int address = page * MEMORY_PAGE_WORDS + i;
+                if (words[i] != first[i] && IsExecutableAddress(address)) {
+                    sweep->divergent[address] = 1;
+                }
+            }
+        }
+    }
+    return sweep;
+}
+
+/*
+ * Run every lane until it halts, faults or has run max_cycles instructions.
+ */
+uint64_t RunSweep(Sweep* sweep, uint64_t max_cycles) {
+    uint64_t total = 0;
+    while (1) {
+        //give every running lane the rest of its cycles, at most a round's worth
+        int anyLeft = 0;
+        for (int l = 0; l < sweep->lanes; l++) {
+            uint64_t rest = sweep->running[l] ? max_cycles - sweep->cycles[l] : 0;
+            sweep->left[l] = sweep->budget[l] = rest < SWEEP_ROUND_STEPS ? rest : SWEEP_ROUND_STEPS;
+            anyLeft |= sweep->left[l];
+        }
+        if (!anyLeft) {
+            break;
+        }
+        sweep->steps += runRound(sweep);
+        for (int l = 0; l < sweep->lanes; l++) {
+            uint16_t ran = sweep->budget[l] - sweep->left[l];
+            sweep->cycles[l] += ran;
+            total += ran;
+        }
+    }
+    return total;
+}
+
+/*
+ * Copy the registers and fault flag of every lane back to its machine.
+ */
+void SweepWriteBack(Sweep* sweep) {
+    for (int l = 0; l < sweep->laneCount; l++) {
+        MachineState* CPU = sweep->machines[l];
+        CPU->PC = sweep->PC[l];
+        CPU->PSR = sweep->PSR[l];
+        for (int r = 0; r < 8; r++) {
+            CPU->R[r] = sweep->R[r][l];
+        }
+        CPU->error = sweep->faulted[l];
+    }
+}
+
+/*
+ * Free the sweep.
+ */
+void FreeSweep(Sweep* sweep) {
+    free(sweep->PC);
+    free(sweep->PSR);
+    for (int r = 0; r < 8; r++) {
+        free(sweep->R[r]);
+    }
+    free(sweep->running);
+    free(sweep->left);
+    free(sweep->budget);
+    free(sweep->group);
+    free(sweep->faulted);
+    free(sweep->cycles);
+    free(sweep->decoded);
+    free(sweep->divergent);
+    free(sweep);
+}
@@ -0,0 +1,88 @@
+/*
+ * sweep.h: Declares the lockstep engine that runs many machines at once
+ *
+ * A sweep runs the same program on many machines that differ only in their
+ * data. Their registers are kept as structure of arrays (every lane's PC
+ * next to each other, then every lane's PSR, R0, ...) so one vector
+ * instruction updates 16 lanes. Each step executes the instruction at the
+ * lowest PC of any running lane, on every lane at that PC: lanes that
+ * branch apart wait at the higher PC until the others catch up, which is
+ * where they meet again. Loads and stores go to each lane's own memory.
+ *
+ * The instruction semantics, quirks included, are those of the threaded
+ * engine, so every lane ends exactly as RunMachine would leave it.
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+#include "LC4.h"
+#include "decode.h"
+
+// Lanes in one vector: 16 words of 16 bits fill an AVX2 register
+#define SWEEP_VECTOR_LANES 16
+
+// Steps between folding the per-lane 16 bit cycle counters into 64 bits
+#define SWEEP_ROUND_STEPS 0x4000
+
+typedef struct {
+    // lanes in use, and the same rounded up to whole vectors (the padding never runs)
+    int laneCount;
+    int lanes;
+
+    // each lane's machine, which holds its memory; its registers are only
+    // brought up to date by SweepWriteBack
+    MachineState** machines;
+
+    // the registers, lanes entries each
+    uint16_t* PC;
+    uint16_t* PSR;
+    uint16_t* R[8];
+
+    // 0xFFFF while the lane has not halted or faulted, and 1 once it faulted
+    uint16_t* running;
+    unsigned char* faulted;
+    // cycles the lane may still run this round, and what it started the round with
+    uint16_t* left;
+    uint16_t* budget;
+    // the lanes taking part in the current step
+    uint16_t* group;
+    uint64_t* cycles;
+
+    // decoded instructions shared by all lanes, for addresses where every lane holds the same word
+    DecodedInsn* decoded;
+    // 1 where lanes may hold different words (loaded differently, or stored to since)
+    unsigned char* divergent;
+
+    // steps taken, for the average lanes per step
+    uint64_t steps;
+} Sweep;
+
+
+/*
+ * Create a sweep over count loaded machines, taking their registers.
+ * Returns NULL if out of memory.
+ */
+Sweep* CreateSweep(MachineState** machines, int count);
+
+
+/*
+ * Run every lane until it halts, faults or has run max_cycles instructions.
+ * Returns the cycles executed, summed over all lanes.
+ */
+uint64_t RunSweep(Sweep* sweep, uint64_t max_cycles);
+
+
+/*
+ * Copy the registers and fault flag of every lane back to its machine.
+ */
+void SweepWriteBack(Sweep* sweep);
+
+
+/*
+ * Free the sweep (not the machines).
+ */
+void FreeSweep(Sweep* sweep);
+
+#endif
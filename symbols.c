@@ -0,0 +1,228 @@
+/*
+ * symbols.c: Defines the symbol and line tables kept from obj file debug sections
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symbols.h"
+
+//helper function to grow an array to hold one more element, returns 0 on success
+static int reserve(void** array, int count, int* capacity, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    int bigger = *capacity ? 2 * *capacity : 64;
+    void* grown = realloc(*array, bigger * size);
+    if (grown == NULL) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = bigger;
+    return 0;
+}
+
+//helper function to copy a name into the name pool, returns its offset or -1
+static int64_t addName(SymbolTable* table, const char* name, size_t length) {
+    if (table->namesSize + length + 1 > table->namesCapacity) {
+        size_t bigger = table->namesCapacity ? table->namesCapacity : 1024;
+        while (table->namesSize + length + 1 > bigger) {
+            bigger *= 2;
+        }
+        char* grown = realloc(table->names, bigger);
+        if (grown == NULL) {
+            return -1;
+        }
+        table->names = grown;
+        table->namesCapacity = bigger;
+    }
+    int64_t offset = table->namesSize;
+    memcpy(table->names + offset, name, length);
+    table->names[offset + length] = '\0';
+    table->namesSize += length + 1;
+    return offset;
+}
+
+/*
+ * Create an empty table.
+ */
+SymbolTable* CreateSymbolTable(void) {
+    return calloc(1, sizeof(SymbolTable));
+}
+
+//helper function to copy count elements of an array, returns 0 on success
+static int copyArray(void** copy, const void* array, size_t count, size_t size) {
+    if (count == 0) {
+        return 0;
+    }
+    *copy = malloc(count * size);
+    if (*copy == NULL) {
+        return -1;
+    }
+    memcpy(*copy, array, count * size);
+    return 0;
+}
+
+/*
+ * Create a copy of table.
+ */
+SymbolTable* CopySymbolTable(const SymbolTable* table) {
+    SymbolTable* copy = CreateSymbolTable();
+    if (copy == NULL) {
+        return NULL;
+    }
+    //the copy's arrays are exactly full, the next add grows them
+    copy->symbolCount = copy->symbolCapacity = table->symbolCount;
+    copy->lineCount = copy->lineCapacity = table->lineCount;
+    copy->fileCount = copy->fileCapacity = table->fileCount;
+    copy->namesSize = copy->namesCapacity = table->namesSize;
+    if (copyArray((void**)&copy->symbols, table->symbols, table->symbolCount, sizeof(Symbol)) != 0
+            || copyArray((void**)&copy->lines, table->lines, table->lineCount, sizeof(LineEntry)) != 0
+            || copyArray((void**)&copy->files, table->files, table->fileCount, sizeof(uint32_t)) != 0
+            || copyArray((void**)&copy->names, table->names, table->namesSize, 1) != 0) {
+        FreeSymbolTable(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/*
+ * Add a label of length bytes at address.
+ */
+int AddSymbol(SymbolTable* table, uint16_t address, const char* name, size_t length) {
+    if (reserve((void**)&table->symbols, table->symbolCount, &table->symbolCapacity, sizeof(Symbol)) != 0) {
+        return -1;
+    }
+    int64_t offset = addName(table, name, length);
+    if (offset < 0) {
+        return -1;
+    }
+    table->symbols[table->symbolCount++] = (Symbol){ address, offset };
+    return 0;
+}
+
+/*
+ * Add a source file name of length bytes, returns its index.
+ */
+int AddSourceFile(SymbolTable* table, const char* name, size_t length) {
+    if (reserve((void**)&table->files, table->fileCount, &table->fileCapacity, sizeof(uint32_t)) != 0) {
+        return -1;
+    }
+    int64_t offset = addName(table, name, length);
+    if (offset < 0) {
+        return -1;
+    }
+    table->files[table->fileCount] = offset;
+    return table->fileCount++;
+}
+
+/*
+ * Add a line entry.
+ */
+int AddLine(SymbolTable* table, uint16_t address, uint16_t line, uint32_t file) {
+    if (reserve((void**)&table->lines, table->lineCount, &table->lineCapacity, sizeof(LineEntry)) != 0) {
+        return -1;
+    }
+    table->lines[table->lineCount++] = (LineEntry){ address, line, file };
+    return 0;
+}
+
+//helper function to order symbols by address, then in the order they were added
+static int compareSymbols(const void* a, const void* b) {
+    const Symbol* x = a;
+    const Symbol* y = b;
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+//helper function to order lines by address
+static int compareLines(const void* a, const void* b) {
+    const LineEntry* x = a;
+    const LineEntry* y = b;
+    return x->address < y->address ? -1 : x->address > y->address;
+}
+
+/*
+ * Sort the symbols and lines by address, keeping the first label of an address.
+ */
+void SortSymbolTable(SymbolTable* table) {
+    qsort(table->symbols, table->symbolCount, sizeof(Symbol), compareSymbols);
+    int kept = 0;
+    for (int i = 0; i < table->symbolCount; i++) {
+        if (kept == 0 || table->symbols[kept - 1].address != table->symbols[i].address) {
+            table->symbols[kept++] = table->symbols[i];
+        }
+    }
+    table->symbolCount = kept;
+    qsort(table->lines, table->lineCount, sizeof(LineEntry), compareLines);
+}
+
+//helper function to find the last of count entries of size bytes whose address (the first field) is at
+//or below address, -1 if there is none
+static int findBelow(const void* entries, int count, size_t size, uint16_t address) {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (*(const uint16_t*)((const char*)entries + middle * size) <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low - 1;
+}
+
+/*
+ * Find the label at or closest below address.
+ */
+const char* FindSymbol(const SymbolTable* table, uint16_t address, uint16_t* offset) {
+    int i = findBelow(table->symbols, table->symbolCount, sizeof(Symbol), address);
+    if (i < 0) {
+        return NULL;
+    }
+    *offset = address - table->symbols[i].address;
+    return table->names + table->symbols[i].name;
+}
+
+/*
+ * Find the line whose code starts at or closest below address.
+ */
+int FindLine(const SymbolTable* table, uint16_t address, const char** file) {
+    int i = findBelow(table->lines, table->lineCount, sizeof(LineEntry), address);
+    if (i < 0) {
+        return 0;
+    }
+    uint32_t index = table->lines[i].file;
+    *file = index < (uint32_t)table->fileCount ? table->names + table->files[index] : NULL;
+    return table->lines[i].line;
+}
+
+/*
+ * Write address as "label", "label+offset" or "xXXXX".
+ */
+char* FormatAddress(const SymbolTable* table, uint16_t address, char* buffer, size_t size) {
+    uint16_t offset = 0;
+    const char* name = table ? FindSymbol(table, address, &offset) : NULL;
+    if (name == NULL) {
+        snprintf(buffer, size, "x%04X", address);
+    } else if (offset) {
+        snprintf(buffer, size, "%s+%u", name, offset);
+    } else {
+        snprintf(buffer, size, "%s", name);
+    }
+    return buffer;
+}
+
+/*
+ * Free the table.
+ */
+void FreeSymbolTable(SymbolTable* table) {
+    free(table->symbols);
+    free(table->lines);
+    free(table->files);
+    free(table->names);
+    free(table);
+}
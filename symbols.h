@@ -0,0 +1,116 @@
+/*
+ * symbols.h: Declares the symbol and line tables kept from obj file debug sections
+ *
+ * The assembler can add three kinds of sections besides code and data:
+ * SYMBOL (a label and its address), FILENAME (a source file) and LINENUMBER
+ * (an address, a line and the index of the FILENAME section of the same obj
+ * file it belongs to). The loader collects them here so tools can name an
+ * address as label+offset and file:line instead of raw hex.
+ */
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// File index of a line whose FILENAME section is missing
+#define SYMBOL_NO_FILE UINT32_MAX
+
+typedef struct {
+    uint16_t address;
+    // offset of the label in names
+    uint32_t name;
+} Symbol;
+
+typedef struct {
+    uint16_t address;
+    uint16_t line;
+    // index into files, SYMBOL_NO_FILE if the obj file named no such file
+    uint32_t file;
+} LineEntry;
+
+typedef struct {
+    // sorted by address once SortSymbolTable has run
+    Symbol* symbols;
+    int symbolCount;
+    int symbolCapacity;
+    LineEntry* lines;
+    int lineCount;
+    int lineCapacity;
+    // source files in load order, as offsets into names
+    uint32_t* files;
+    int fileCount;
+    int fileCapacity;
+    // every label and file name, NUL terminated, back to back
+    char* names;
+    size_t namesSize;
+    size_t namesCapacity;
+} SymbolTable;
+
+
+/*
+ * Create an empty table, NULL if out of memory.
+ */
+SymbolTable* CreateSymbolTable(void);
+
+
+/*
+ * Create a copy of table, NULL if out of memory.
+ */
+SymbolTable* CopySymbolTable(const SymbolTable* table);
+
+
+/*
+ * Add a label of length bytes at address, returns 0 on success.
+ */
+int AddSymbol(SymbolTable* table, uint16_t address, const char* name, size_t length);
+
+
+/*
+ * Add a source file name of length bytes, returns its index or -1.
+ */
+int AddSourceFile(SymbolTable* table, const char* name, size_t length);
+
+
+/*
+ * Add a line entry, file being an index returned by AddSourceFile.
+ * Returns 0 on success.
+ */
+int AddLine(SymbolTable* table, uint16_t address, uint16_t line, uint32_t file);
+
+
+/*
+ * Sort the symbols and lines by address, keeping the first label added for
+ * an address. Lookups need a sorted table.
+ */
+void SortSymbolTable(SymbolTable* table);
+
+
+/*
+ * Find the label at or closest below address, setting offset to the distance
+ * from it. Returns NULL if there is none.
+ */
+const char* FindSymbol(const SymbolTable* table, uint16_t address, uint16_t* offset);
+
+
+/*
+ * Find the line whose code starts at or closest below address, setting file
+ * to its source file name (NULL if unknown). Returns 0 if there is none.
+ */
+int FindLine(const SymbolTable* table, uint16_t address, const char** file);
+
+
+/*
+ * Write address as "label" or "label+offset" into buffer, or as "xXXXX" when
+ * no label precedes it (or table is NULL). Returns buffer.
+ */
+char* FormatAddress(const SymbolTable* table, uint16_t address, char* buffer, size_t size);
+
+
+/*
+ * Free the table.
+ */
+void FreeSymbolTable(SymbolTable* table);
+
+#endif
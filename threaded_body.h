@@ -0,0 +1,360 @@
+/*
+ * threaded_body.h: Body of the direct-threaded engine, instantiated by engine.c
+ * once per observation policy. Before including it define:
+ *   ENGINE_FN      name of the function to generate
+ *   ENGINE_POLICY  POLICY_TRACE, POLICY_COUNT, POLICY_UNDO, POLICY_PROFILE or
+ *                  POLICY_NONE
+ * The policy is a compile time constant, so each copy only contains the work
+ * its policy needs: control signals and trace lines for POLICY_TRACE, per
+ * operation counters for POLICY_COUNT, undo records for POLICY_UNDO, the
+ * profiler's counters and shadow call stack for POLICY_PROFILE and none of
+ * them for POLICY_NONE.
+ */
+
+#define TRACING (ENGINE_POLICY == POLICY_TRACE)
+#define COUNTING (ENGINE_POLICY == POLICY_COUNT)
+#define UNDOING (ENGINE_POLICY == POLICY_UNDO)
+#define PROFILING (ENGINE_POLICY == POLICY_PROFILE)
+
+static uint64_t ENGINE_FN(MachineState* CPU, TraceWriter* trace, uint64_t* counts, UndoLog* undo, Profile* profile, uint64_t max_cycles) {
+    static void* const dispatch[OP_COUNT] = {
+        [OP_UNDECODED] = &&do_decode,
+        [OP_BR] = &&do_br,
+        [OP_ADD] = &&do_add,
+        [OP_MUL] = &&do_mul,
+        [OP_SUB] = &&do_sub,
+        [OP_DIV] = &&do_div,
+        [OP_ADDI] = &&do_addi,
+        [OP_CMP] = &&do_cmp,
+        [OP_CMPU] = &&do_cmpu,
+        [OP_CMPI] = &&do_cmpi,
+        [OP_CMPIU] = &&do_cmpiu,
+        [OP_JSRR] = &&do_jsrr,
+        [OP_JSR] = &&do_jsr,
+        [OP_AND] = &&do_and,
+        [OP_NOT] = &&do_not,
+        [OP_OR] = &&do_or,
+        [OP_XOR] = &&do_xor,
+        [OP_ANDI] = &&do_andi,
+        [OP_LDR] = &&do_ldr,
+        [OP_STR] = &&do_str,
+        [OP_RTI] = &&do_rti,
+        [OP_CONST] = &&do_const,
+        [OP_SLL] = &&do_sll,
+        [OP_SRA] = &&do_sra,
+        [OP_SRL] = &&do_srl,
+        [OP_MOD] = &&do_mod,
+        [OP_JMPR] = &&do_jmpr,
+        [OP_JMP] = &&do_jmp,
+        [OP_HICONST] = &&do_hiconst,
+        [OP_BADHICONST] = &&do_fault,
+        [OP_TRAP] = &&do_trap,
+        [OP_ILLEGAL] = &&do_halt,
+        [OP_HALT] = &&do_halt,
+    };
+
+    if (CPU->decoded == NULL) {
+        AttachDecodeCache(CPU);
+    }
+    DecodedInsn* cache = CPU->decoded;
+    unsigned short* R = CPU->R;
+    const DecodedInsn* insn;
+    uint64_t cycles = 0;
+    unsigned char op;
+    int ans;
+
+    (void)trace;
+    (void)counts;
+    (void)undo;
+    (void)profile;
+
+// fetch the decoded record at PC and jump straight to its handler
+#define DISPATCH() do { \
+        if (cycles == max_cycles) goto do_halt; \
+        if (TRACING && trace->index && trace->index->cycle == trace->index->nextSnapshot) \
+            TraceIndexSnapshot(trace->index, CPU); \
+        insn = &cache[CPU->PC]; \
+        op = insn->op; \
+        if (UNDOING) UndoCapture(undo, CPU, insn); \
+        goto *dispatch[op]; \
+    } while (0)
+
+// finish the cycle: observe it, move the PC and chain into the next handler
+#define NEXT(newPC) do { \
+        if (TRACING && PhaseTiming && cycles % PHASE_SAMPLE_EVERY == 0) { \
+            PhaseScope scope = PhaseBegin(); \
+            TraceEmitState(trace, CPU); \
+            PhaseEndSampled(PHASE_FORMAT, scope, 1, PHASE_SAMPLE_EVERY); \
+        } else if (TRACING) { \
+            TraceEmitState(trace, CPU); \
+        } \
+        if (COUNTING) counts[op]++; \
+        if (UNDOING) UndoCommit(undo); \
+        unsigned short nextPC = (newPC); \
+        if (PROFILING) ProfileCycle(profile, insn, CPU->PC, nextPC); \
+        CPU->PC = nextPC; \
+        cycles++; \
+        DISPATCH(); \
+    } while (0)
+
+// the six control signals, only kept up to date when they will be traced
+#define SIGNALS(rs, rt, rd, regWE, nzpWE, dataWE) do { \
+        if (TRACING) { \
+            CPU->rsMux_CTL = (rs); \
+            CPU->rtMux_CTL = (rt); \
+            CPU->rdMux_CTL = (rd); \
+            CPU->regFile_WE = (regWE); \
+            CPU->NZP_WE = (nzpWE); \
+            CPU->DATA_WE = (dataWE); \
+        } \
+    } while (0)
+
+// a value only the trace reports (regInputVal, dmemAddr, ...)
+#define TRACED(field, value) do { \
+        if (TRACING) CPU->field = (value); \
+    } while (0)
+
+// same result as SetNZP, NZPVal is only needed by the trace
+#define SET_NZP(result) do { \
+        short nzpResult = (result); \
+        unsigned short nzp = (nzpResult < 0) ? 4 : (nzpResult == 0) ? 2 : 1; \
+        CPU->PSR = (CPU->PSR & 0xFFF8) | nzp; \
+        TRACED(NZPVal, nzp); \
+    } while (0)
+
+// ArithmeticOp tail shared by add, mul, sub, div and add immediate
+#define ARITH_DONE() do { \
+        SIGNALS(0, 0, insn->rd, 1, 1, 0); \
+        TRACED(regInputVal, ans); \
+        SET_NZP(ans); \
+        R[insn->rd] = ans; \
+        NEXT(CPU->PC + 1); \
+    } while (0)
+
+// ComparativeOp tail
+#define CMP_DONE(result) do { \
+        SIGNALS(insn->rs, 0, 0, 0, 1, 0); \
+        SET_NZP(result); \
+        NEXT(CPU->PC + 1); \
+    } while (0)
+
+// LogicalOp tail
+#define LOGIC_DONE(rtCtl) do { \
+        SIGNALS(insn->rs, (rtCtl), insn->rd, 1, 1, 0); \
+        TRACED(regInputVal, R[insn->rd]); \
+        SET_NZP(R[insn->rd]); \
+        NEXT(CPU->PC + 1); \
+    } while (0)
+
+// ShiftModOp tail
+#define SHIFT_DONE() do { \
+        SIGNALS(0, 0, 0, 1, 1, 0); \
+        TRACED(regInputVal, R[insn->rd]); \
+        SET_NZP(R[insn->rd]); \
+        NEXT(CPU->PC + 1); \
+    } while (0)
+
+// JumpOp tail
+#define JUMP_DONE(newPC) do { \
+        SIGNALS(0, 0, 0, 0, 0, 0); \
+        NEXT(newPC); \
+    } while (0)
+
+// JSROp and trapOp both save the return address in R7
+#define LINK_R7() do { \
+        R[7] = CPU->PC + 1; \
+        TRACED(regInputVal, R[7]); \
+        SIGNALS(0, 0, 7, 1, 1, 0); \
+        SET_NZP(R[7]); \
+    } while (0)
+
+    DISPATCH();
+
+do_decode:
+    DecodeAt(CPU, CPU->PC);
+    op = insn->op;
+    //the undo record taken at dispatch did not know the operation yet
+    if (UNDOING) UndoCapture(undo, CPU, insn);
+    goto *dispatch[op];
+
+do_br: {
+    int taken = CPU->PSR & insn->rd & 0x7;
+    //BR with no condition bits is a NOP (and the padding word 0), not a branch
+    if (PROFILING && (insn->rd & 0x7)) ProfileBranch(profile, CPU->PC, taken);
+    SIGNALS(0, 0, 0, 0, 0, 0);
+    NEXT(CPU->PC + (taken ? insn->imm + 1 : 1));
+}
+
+do_add:
+    ans = (short)R[insn->rs] + (short)R[insn->rt];
+    ARITH_DONE();
+
+do_mul:
+    ans = (short)R[insn->rs] * (short)R[insn->rt];
+    ARITH_DONE();
+
+do_sub:
+    ans = (short)R[insn->rs] - (short)R[insn->rt];
+    ARITH_DONE();
+
+do_div:
+    if (R[insn->rt] == 0) {
+        goto do_fault;
+    }
+    ans = (short)R[insn->rs] / (short)R[insn->rt];
+    ARITH_DONE();
+
+do_addi:
+    ans = (short)R[insn->rs] + insn->imm;
+    ARITH_DONE();
+
+do_cmp:
+    CMP_DONE((short)R[insn->rs] - (short)R[insn->rt]);
+
+do_cmpu:
+    CMP_DONE((short)(R[insn->rs] - R[insn->rt]));
+
+do_cmpi:
+    CMP_DONE((short)R[insn->rs] - insn->imm);
+
+do_cmpiu:
+    CMP_DONE((short)(R[insn->rs] - (unsigned short)insn->imm));
+
+do_jsrr:
+    LINK_R7();
+    NEXT(insn->rs);
+
+do_jsr:
+    LINK_R7();
+    NEXT((CPU->PC & 0x8000) | (insn->imm << 4));
+
+do_and:
+    R[insn->rd] = R[insn->rs] & R[insn->rt];
+    LOGIC_DONE(insn->rt);
+
+do_not:
+    R[insn->rd] = ~R[insn->rs];
+    LOGIC_DONE(insn->rt);
+
+do_or:
+    R[insn->rd] = R[insn->rs] | R[insn->rt];
+    LOGIC_DONE(insn->rt);
+
+do_xor:
+    R[insn->rd] = R[insn->rs] ^ R[insn->rt];
+    LOGIC_DONE(insn->rt);
+
+do_andi:
+    R[insn->rd] = R[insn->rs] & insn->imm;
+    LOGIC_DONE(0);
+
+do_ldr: {
+    unsigned short memAddress = R[insn->rs] + insn->imm;
+    if (BadDataAddress(CPU->PSR, memAddress) || insn->rs == insn->rd) {
+        goto do_fault;
+    }
+    R[insn->rd] = CPU->memory[memAddress];
+    TRACED(regInputVal, R[insn->rd]);
+    SIGNALS(insn->rs, 0, insn->rd, 1, 1, 0);
+    SET_NZP(R[insn->rd]);
+    NEXT(CPU->PC + 1);
+}
+
+do_str: {
+    unsigned short memAddress = R[insn->rs] + insn->imm;
+    if (BadDataAddress(CPU->PSR, memAddress) || insn->rs == insn->rt) {
+        goto do_fault;
+    }
+    //the store may rewrite code, so drop its decoded copy
+    CPU->memory[memAddress] = R[insn->rt];
+    MarkWritten(CPU, memAddress);
+    cache[memAddress].op = OP_UNDECODED;
+    SIGNALS(insn->rs, insn->rt, 0, 0, 0, 1);
+    TRACED(dmemAddr, memAddress);
+    TRACED(dmemValue, R[insn->rt]);
+    NEXT(CPU->PC + 1);
+}
+
+do_rti:
+    if (TRACING) {
+        CPU->regFile_WE = 0;
+        CPU->NZP_WE = 0;
+        CPU->DATA_WE = 0;
+    }
+    NEXT(R[7]);
+
+do_const:
+    R[insn->rd] = insn->imm;
+    if (TRACING) {
+        CPU->regFile_WE = 1;
+        CPU->NZP_WE = 1;
+        CPU->DATA_WE = 0;
+        CPU->rdMux_CTL = insn->rd;
+        CPU->regInputVal = insn->imm;
+        CPU->dmemAddr = 0;
+        CPU->dmemValue = 0;
+    }
+    SET_NZP(insn->imm);
+    NEXT(CPU->PC + 1);
+
+do_sll:
+    R[insn->rd] = R[insn->rs] << insn->imm;
+    SHIFT_DONE();
+
+do_sra:
+    //ShiftModOp shifts left here as well, kept so both engines agree
+    R[insn->rd] = (short)R[insn->rs] << insn->imm;
+    SHIFT_DONE();
+
+do_srl:
+    R[insn->rd] = R[insn->rs] >> insn->imm;
+    SHIFT_DONE();
+
+do_mod:
+    if (R[insn->rt] == 0) {
+        goto do_fault;
+    }
+    R[insn->rd] = R[insn->rs] % R[insn->rt];
+    SHIFT_DONE();
+
+do_jmpr:
+    JUMP_DONE(insn->rs);
+
+do_jmp:
+    JUMP_DONE((CPU->PC & 0x8000) | (insn->imm << 4));
+
+do_hiconst:
+    R[insn->rd] = (R[insn->rd] & 0x0FF) | (insn->imm << 8);
+    TRACED(regInputVal, R[insn->rd]);
+    SIGNALS(0, 0, insn->rd, 1, 1, 0);
+    SET_NZP(R[insn->rd]);
+    NEXT(CPU->PC + 1);
+
+do_trap:
+    LINK_R7();
+    CPU->PSR |= 0x8000;
+    NEXT(0x8000 | insn->imm);
+
+do_fault:
+    CPU->error = 1;
+
+do_halt:
+    return cycles;
+
+#undef DISPATCH
+#undef NEXT
+#undef SIGNALS
+#undef TRACED
+#undef SET_NZP
+#undef ARITH_DONE
+#undef CMP_DONE
+#undef LOGIC_DONE
+#undef SHIFT_DONE
+#undef JUMP_DONE
+#undef LINK_R7
+}
+
+#undef TRACING
+#undef COUNTING
+#undef UNDOING
+#undef PROFILING
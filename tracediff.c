@@ -0,0 +1,217 @@
+/*
+ * tracediff.c: finds the first cycle where two traces diverge
+ */
+
+#include "bintrace.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// One trace being compared: a mapped text trace, or a binary trace decoded line by line
+typedef struct {
+    const char* name;
+    const unsigned char* data;
+    size_t size;
+
+    // NULL for text traces
+    BinaryTraceReader* reader;
+
+    // next text line, or the last decoded binary record rendered as text
+    size_t pos;
+    char line[TRACE_LINE_LENGTH];
+
+    // set when a binary trace turned out to be truncated or corrupt
+    int corrupt;
+} TraceInput;
+
+// Fields of a trace line, for the breakdown of a divergent cycle
+static const struct {
+    const char* name;
+    int offset;
+    int width;
+} traceFields[] = {
+    { "PC", 0, 4 },
+    { "instruction", 5, 16 },
+    { "regFile_WE", 22, 1 },
+    { "rdMux_CTL", 24, 1 },
+    { "regInputVal", 26, 4 },
+    { "NZP_WE", 31, 1 },
+    { "NZPVal", 33, 1 },
+    { "DATA_WE", 35, 1 },
+    { "dmemAddr", 37, 4 },
+    { "dmemValue", 42, 4 },
+};
+
+//helper function to map a trace and work out its format, returns 0 on success
+static int openInput(TraceInput* input, const char* filename) {
+    memset(input, 0, sizeof(TraceInput));
+    input->name = filename;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening trace");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        perror("Error reading trace");
+        close(fd);
+        return -1;
+    }
+    input->size = info.st_size;
+    //an empty trace is valid: the program halted straight away
+    if (input->size) {
+        void* data = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("Error mapping trace");
+            close(fd);
+            return -1;
+        }
+        madvise(data, input->size, MADV_SEQUENTIAL);
+        input->data = data;
+    }
+    close(fd);
+
+    if (input->size >= 4 && memcmp(input->data, BINARY_TRACE_MAGIC, 4) == 0) {
+        input->reader = malloc(sizeof(BinaryTraceReader));
+        if (input->reader == NULL || OpenBinaryTrace(input->reader, input->data, input->size) != 0) {
+            printf("Error: %s is not a valid binary trace\n", filename);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//helper function to get the next line of a trace, NULL at its end
+static const char* nextLine(TraceInput* input) {
+    if (input->reader == NULL) {
+        if (input->pos + TRACE_LINE_LENGTH > input->size) {
+            return NULL;
+        }
+        input->pos += TRACE_LINE_LENGTH;
+        return (const char*)input->data + input->pos - TRACE_LINE_LENGTH;
+    }
+    TraceRecord rec;
+    int status = ReadBinaryRecord(input->reader, &rec);
+    if (status != 1) {
+        input->corrupt = status < 0;
+        return NULL;
+    }
+    FormatTraceLine(input->line, &rec);
+    return input->line;
+}
+
+//helper function to find the first byte where a and b differ, len if they are equal
+static size_t firstMismatch(const unsigned char* a, const unsigned char* b, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    //64 bytes per step: four compares folded together, one mask test
+    for (; i + 64 <= len; i += 64) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)), _mm_loadu_si128((const __m128i*)(b + i + 16)));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 32)), _mm_loadu_si128((const __m128i*)(b + i + 32)));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 48)), _mm_loadu_si128((const __m128i*)(b + i + 48)));
+        __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) {
+            break;
+        }
+    }
+    //narrow down to the differing 16 bytes
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                                    _mm_loadu_si128((const __m128i*)(b + i))));
+        if (mask != 0xFFFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (a[i] != b[i]) {
+            return i;
+        }
+    }
+    return len;
+}
+
+//helper function to print the line of each trace at the divergent cycle, field by field
+static void printBreakdown(const TraceInput* a, const char* lineA, const TraceInput* b, const char* lineB) {
+    printf("%-12s %-16s %-16s\n", "field", a->name, b->name);
+    for (size_t f = 0; f < sizeof(traceFields) / sizeof(traceFields[0]); f++) {
+        int offset = traceFields[f].offset;
+        int width = traceFields[f].width;
+        int differs = memcmp(lineA + offset, lineB + offset, width) != 0;
+        printf("%-12s %-16.*s %-16.*s%s\n", traceFields[f].name, width, lineA + offset,
+               width, lineB + offset, differs ? " <--" : "");
+    }
+}
+
+//helper function to report a trace that ends while the other one goes on
+static void printEnd(uint64_t cycle, const TraceInput* shorter, const TraceInput* longer, const char* line) {
+    printf("traces diverge at cycle %llu: %s %s, %s continues with\n%.*s",
+           (unsigned long long)cycle, shorter->name,
+           shorter->corrupt ? "is truncated or corrupt" : "ends", longer->name, TRACE_LINE_LENGTH, line);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: %s first_trace second_trace\n", argv[0]);
+        printf("Traces may be text or binary (trace -b) in any combination.\n");
+        printf("Exits with 0 if they are identical and 1 if they diverge.\n");
+        return -1;
+    }
+
+    TraceInput a, b;
+    if (openInput(&a, argv[1]) != 0 || openInput(&b, argv[2]) != 0) {
+        return -1;
+    }
+
+    //two text traces: compare the mappings directly and turn the byte offset into a cycle
+    if (a.reader == NULL && b.reader == NULL) {
+        size_t common = a.size < b.size ? a.size : b.size;
+        size_t offset = firstMismatch(a.data, b.data, common);
+        if (offset == common && a.size == b.size) {
+            return 0;
+        }
+        a.pos = b.pos = offset - offset % TRACE_LINE_LENGTH;
+    }
+
+    //walk both traces line by line (from the divergent line, for two text traces)
+    uint64_t cycle = a.pos / TRACE_LINE_LENGTH;
+    while (1) {
+        const char* lineA = nextLine(&a);
+        const char* lineB = nextLine(&b);
+        if (lineA == NULL && lineB == NULL) {
+            if (a.corrupt || b.corrupt) {
+                printf("traces diverge at cycle %llu: %s is truncated or corrupt\n",
+                       (unsigned long long)cycle, a.corrupt ? a.name : b.name);
+                return 1;
+            }
+            if (a.reader == NULL && b.reader == NULL) {
+                //only a partial last line differs
+                printf("traces diverge at cycle %llu: %s has %zu bytes, %s has %zu\n", (unsigned long long)cycle,
+                       a.name, a.size, b.name, b.size);
+                return 1;
+            }
+            return 0;
+        }
+        if (lineA == NULL) {
+            printEnd(cycle, &a, &b, lineB);
+            return 1;
+        }
+        if (lineB == NULL) {
+            printEnd(cycle, &b, &a, lineA);
+            return 1;
+        }
+        if (memcmp(lineA, lineB, TRACE_LINE_LENGTH) != 0) {
+            printf("traces diverge at cycle %llu (line %llu)\n", (unsigned long long)cycle,
+                   (unsigned long long)cycle + 1);
+            printBreakdown(&a, lineA, &b, lineB);
+            return 1;
+        }
+        cycle++;
+    }
+}
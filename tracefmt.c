@@ -0,0 +1,82 @@
+/*
+ * tracefmt.c: Defines the table-driven formatter for trace lines
+ */
+
+#include "tracefmt.h"
+
+//one hex digit as a constant expression, usable in the static tables below
+#define HEX_DIGIT(n) ((n) < 10 ? '0' + (n) : 'A' + (n) - 10)
+
+//binary digits of one byte, most significant bit first
+#define BIN_ROW(b) { '0' + (((b) >> 7) & 1), '0' + (((b) >> 6) & 1), '0' + (((b) >> 5) & 1), '0' + (((b) >> 4) & 1), \
+                     '0' + (((b) >> 3) & 1), '0' + (((b) >> 2) & 1), '0' + (((b) >> 1) & 1), '0' + ((b) & 1) }
+#define BIN_ROW4(b) BIN_ROW(b), BIN_ROW((b) + 1), BIN_ROW((b) + 2), BIN_ROW((b) + 3)
+#define BIN_ROW16(b) BIN_ROW4(b), BIN_ROW4((b) + 4), BIN_ROW4((b) + 8), BIN_ROW4((b) + 12)
+#define BIN_ROW64(b) BIN_ROW16(b), BIN_ROW16((b) + 16), BIN_ROW16((b) + 32), BIN_ROW16((b) + 48)
+
+//both hex digits of one byte
+#define HEX_ROW(b) { HEX_DIGIT(((b) >> 4) & 0xF), HEX_DIGIT((b) & 0xF) }
+#define HEX_ROW4(b) HEX_ROW(b), HEX_ROW((b) + 1), HEX_ROW((b) + 2), HEX_ROW((b) + 3)
+#define HEX_ROW16(b) HEX_ROW4(b), HEX_ROW4((b) + 4), HEX_ROW4((b) + 8), HEX_ROW4((b) + 12)
+#define HEX_ROW64(b) HEX_ROW16(b), HEX_ROW16((b) + 16), HEX_ROW16((b) + 32), HEX_ROW16((b) + 48)
+
+static const char byteBits[256][8] = { BIN_ROW64(0), BIN_ROW64(64), BIN_ROW64(128), BIN_ROW64(192) };
+static const char byteHex[256][2] = { HEX_ROW64(0), HEX_ROW64(64), HEX_ROW64(128), HEX_ROW64(192) };
+static const char hexDigits[16] = "0123456789ABCDEF";
+
+//write a 16 bit value as 4 hex digits
+static inline void putHex4(char* dst, unsigned short value) {
+    memcpy(dst, byteHex[value >> 8], 2);
+    memcpy(dst + 2, byteHex[value & 0xFF], 2);
+}
+
+/*
+ * Render one record as a trace line into dst.
+ */
+void FormatTraceLine(char* dst, const TraceRecord* rec) {
+    //pc in hex and the instruction in binary
+    putHex4(dst, rec->PC);
+    dst[4] = ' ';
+    memcpy(dst + 5, byteBits[rec->instruction >> 8], 8);
+    memcpy(dst + 13, byteBits[rec->instruction & 0xFF], 8);
+    dst[21] = ' ';
+
+    //regFile_WE, then rdMux_CTL and regInputVal if it is high
+    dst[22] = hexDigits[rec->regFile_WE & 0xF];
+    dst[23] = ' ';
+    if (rec->regFile_WE) {
+        dst[24] = hexDigits[rec->rdMux_CTL & 0xF];
+        dst[25] = ' ';
+        putHex4(dst + 26, rec->regInputVal);
+    } else {
+        memcpy(dst + 24, "0 0000", 6);
+    }
+    dst[30] = ' ';
+
+    //NZP_WE, then NZP val if it is high
+    dst[31] = hexDigits[rec->NZP_WE & 0xF];
+    dst[32] = ' ';
+    dst[33] = rec->NZP_WE ? hexDigits[rec->NZPVal & 0xF] : '0';
+    dst[34] = ' ';
+
+    //DATA_WE, then dmem address and value if it is high
+    dst[35] = hexDigits[rec->DATA_WE & 0xF];
+    dst[36] = ' ';
+    if (rec->DATA_WE) {
+        putHex4(dst + 37, rec->dmemAddr);
+        dst[41] = ' ';
+        putHex4(dst + 42, rec->dmemValue);
+    } else {
+        memcpy(dst + 37, "0000 0000", 9);
+    }
+    dst[46] = '\n';
+}
+
+/*
+ * Same as FormatTraceLine for the cycle the CPU has just executed.
+ */
+void FormatStateLine(char* dst, const MachineState* CPU) {
+    TraceRecord rec;
+    RecordFromState(CPU, &rec);
+    FormatTraceLine(dst, &rec);
+}
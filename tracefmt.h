@@ -0,0 +1,67 @@
+/*
+ * tracefmt.h: Declares the table-driven formatter for trace lines
+ */
+
+#ifndef TRACEFMT_H
+#define TRACEFMT_H
+
+#include "LC4.h"
+
+// Every trace line has the same width:
+// "PPPP BBBBBBBBBBBBBBBB W R VVVV W N W AAAA DDDD\n"
+#define TRACE_LINE_LENGTH 47
+
+// Trace file formats
+enum {
+    TRACE_TEXT,     // the PennSim compatible text lines
+    TRACE_BINARY    // compact records, see bintrace.h
+};
+
+// One cycle of the trace, holding exactly what WriteOut prints
+typedef struct {
+    unsigned short PC;
+    unsigned short instruction;
+    unsigned char regFile_WE;
+    unsigned char rdMux_CTL;
+    unsigned char NZP_WE;
+    unsigned char DATA_WE;
+    unsigned short regInputVal;
+    unsigned short NZPVal;
+    unsigned short dmemAddr;
+    unsigned short dmemValue;
+} TraceRecord;
+
+
+/*
+ * Capture the trace record for the cycle the CPU has just executed
+ * (called where WriteOut is, before the PC moves on).
+ */
+static inline void RecordFromState(const MachineState* CPU, TraceRecord* rec) {
+    rec->PC = CPU->PC;
+    rec->instruction = CPU->memory[CPU->PC];
+    rec->regFile_WE = CPU->regFile_WE;
+    rec->rdMux_CTL = CPU->rdMux_CTL;
+    rec->NZP_WE = CPU->NZP_WE;
+    rec->DATA_WE = CPU->DATA_WE;
+    rec->regInputVal = CPU->regInputVal;
+    rec->NZPVal = CPU->NZPVal;
+    rec->dmemAddr = CPU->dmemAddr;
+    rec->dmemValue = CPU->dmemValue;
+}
+
+
+/*
+ * Render one record as a trace line into dst, which must have room for
+ * TRACE_LINE_LENGTH bytes (no terminating null is written).
+ * The output matches WriteOut's original fprintf format byte for byte;
+ * the single-digit fields (WE flags, rdMux_CTL, NZPVal) are printed as one hex digit.
+ */
+void FormatTraceLine(char* dst, const TraceRecord* rec);
+
+
+/*
+ * Same as FormatTraceLine for the cycle the CPU has just executed.
+ */
+void FormatStateLine(char* dst, const MachineState* CPU);
+
+#endif
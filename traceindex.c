@@ -0,0 +1,277 @@
+/*
+ * traceindex.c: Defines the sidecar index that makes trace files seekable
+ */
+
+#include "traceindex.h"
+
+//helper functions to pack and unpack little endian values
+static void putLE(unsigned char* dst, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        dst[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t getLE(const unsigned char* src, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+//helper function to allocate an empty index
+static TraceIndex* newIndex(void) {
+    TraceIndex* index = calloc(1, sizeof(TraceIndex));
+    if (index == NULL) {
+        return NULL;
+    }
+    index->firstCycle = malloc(65536 * sizeof(uint64_t));
+    if (index->firstCycle == NULL) {
+        free(index);
+        return NULL;
+    }
+    for (int i = 0; i < 65536; i++) {
+        index->firstCycle[i] = TRACE_INDEX_NEVER;
+    }
+    return index;
+}
+
+/*
+ * Start an index that snapshots every interval cycles.
+ */
+TraceIndex* CreateTraceIndex(FILE* file, int format, uint32_t interval, uint64_t headerBytes) {
+    TraceIndex* index = newIndex();
+    if (index == NULL) {
+        return NULL;
+    }
+    index->file = file;
+    index->format = format;
+    index->interval = interval;
+    index->headerBytes = headerBytes;
+    index->offset = headerBytes;
+    index->lastPC = 0xFFFF;
+    return index;
+}
+
+/*
+ * Snapshot the machine before the cycle it is about to execute.
+ */
+void TraceIndexSnapshot(TraceIndex* index, const MachineState* CPU) {
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? 2 * index->capacity : 1024;
+        TraceIndexEntry* entries = realloc(index->entries, capacity * sizeof(TraceIndexEntry));
+        if (entries == NULL) {
+            //keep the snapshots taken so far, the index just gets coarser
+            index->nextSnapshot += index->interval;
+            return;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    TraceIndexEntry* entry = &index->entries[index->count++];
+    entry->cycle = index->cycle;
+    entry->offset = index->offset;
+    entry->PC = CPU->PC;
+    entry->PSR = CPU->PSR;
+    memcpy(entry->R, CPU->R, sizeof(entry->R));
+    entry->lastPC = index->lastPC;
+    index->nextSnapshot += index->interval;
+}
+
+/*
+ * Remember that the record's store rewrote code.
+ */
+void TraceIndexCodeWrite(TraceIndex* index, const TraceRecord* rec) {
+    if (index->writesLost) {
+        return;
+    }
+    if (index->writeCount == index->writeCapacity) {
+        size_t capacity = index->writeCapacity ? 2 * index->writeCapacity : 64;
+        TraceCodeWrite* writes = realloc(index->writes, capacity * sizeof(TraceCodeWrite));
+        if (writes == NULL) {
+            //readers are told, rather than shown code that was rewritten
+            fprintf(stderr, "Warning: out of memory, the index will not replay rewritten code\n");
+            index->writesLost = 1;
+            return;
+        }
+        index->writes = writes;
+        index->writeCapacity = capacity;
+    }
+    TraceCodeWrite* write = &index->writes[index->writeCount++];
+    write->cycle = index->cycle;
+    write->address = rec->dmemAddr;
+    write->value = rec->dmemValue;
+}
+
+/*
+ * Write the index file and free the index, returns 0 on success.
+ */
+int CloseTraceIndex(TraceIndex* index) {
+    unsigned char header[TRACE_INDEX_HEADER_SIZE];
+    memcpy(header, TRACE_INDEX_MAGIC, 4);
+    putLE(header + 4, TRACE_INDEX_VERSION, 2);
+    putLE(header + 6, index->format, 2);
+    putLE(header + 8, index->interval, 4);
+    putLE(header + 12, index->headerBytes, 8);
+    putLE(header + 20, index->cycle, 8);
+    putLE(header + 28, index->count, 8);
+    int failed = fwrite(header, 1, sizeof(header), index->file) != sizeof(header);
+
+    for (size_t i = 0; i < index->count; i++) {
+        TraceIndexEntry* entry = &index->entries[i];
+        unsigned char bytes[TRACE_INDEX_ENTRY_SIZE];
+        putLE(bytes, entry->cycle, 8);
+        putLE(bytes + 8, entry->offset, 8);
+        putLE(bytes + 16, entry->PC, 2);
+        putLE(bytes + 18, entry->PSR, 2);
+        for (int r = 0; r < 8; r++) {
+            putLE(bytes + 20 + 2 * r, entry->R[r], 2);
+        }
+        putLE(bytes + 36, entry->lastPC, 2);
+        failed |= fwrite(bytes, 1, sizeof(bytes), index->file) != sizeof(bytes);
+    }
+
+    for (int pc = 0; pc < 65536; pc++) {
+        unsigned char bytes[8];
+        putLE(bytes, index->firstCycle[pc], 8);
+        failed |= fwrite(bytes, 1, sizeof(bytes), index->file) != sizeof(bytes);
+    }
+
+    unsigned char count[8];
+    putLE(count, index->writesLost ? TRACE_INDEX_NEVER : index->writeCount, 8);
+    failed |= fwrite(count, 1, sizeof(count), index->file) != sizeof(count);
+    for (size_t i = 0; !index->writesLost && i < index->writeCount; i++) {
+        unsigned char bytes[TRACE_INDEX_WRITE_SIZE];
+        putLE(bytes, index->writes[i].cycle, 8);
+        putLE(bytes + 8, index->writes[i].address, 2);
+        putLE(bytes + 10, index->writes[i].value, 2);
+        failed |= fwrite(bytes, 1, sizeof(bytes), index->file) != sizeof(bytes);
+    }
+
+    FreeTraceIndex(index);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Read an index file into memory, NULL if it is missing or malformed.
+ */
+TraceIndex* LoadTraceIndex(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    TraceIndex* index = newIndex();
+    unsigned char header[TRACE_INDEX_HEADER_SIZE];
+    if (index == NULL || fread(header, 1, sizeof(header), file) != sizeof(header)
+            || memcmp(header, TRACE_INDEX_MAGIC, 4) != 0 || getLE(header + 4, 2) != TRACE_INDEX_VERSION) {
+        goto fail;
+    }
+    index->format = getLE(header + 6, 2);
+    index->interval = getLE(header + 8, 4);
+    index->headerBytes = getLE(header + 12, 8);
+    index->cycle = getLE(header + 20, 8);
+    index->count = getLE(header + 28, 8);
+
+    //read the entries in one go and unpack them
+    size_t entryBytes = index->count * TRACE_INDEX_ENTRY_SIZE;
+    unsigned char* bytes = malloc(entryBytes + 65536 * 8);
+    index->entries = malloc(index->count * sizeof(TraceIndexEntry) + 1);
+    index->capacity = index->count;
+    if (bytes == NULL || index->entries == NULL
+            || fread(bytes, 1, entryBytes + 65536 * 8, file) != entryBytes + 65536 * 8) {
+        free(bytes);
+        goto fail;
+    }
+    for (size_t i = 0; i < index->count; i++) {
+        const unsigned char* src = bytes + i * TRACE_INDEX_ENTRY_SIZE;
+        TraceIndexEntry* entry = &index->entries[i];
+        entry->cycle = getLE(src, 8);
+        entry->offset = getLE(src + 8, 8);
+        entry->PC = getLE(src + 16, 2);
+        entry->PSR = getLE(src + 18, 2);
+        for (int r = 0; r < 8; r++) {
+            entry->R[r] = getLE(src + 20 + 2 * r, 2);
+        }
+        entry->lastPC = getLE(src + 36, 2);
+    }
+    for (int pc = 0; pc < 65536; pc++) {
+        index->firstCycle[pc] = getLE(bytes + entryBytes + 8 * pc, 8);
+    }
+    free(bytes);
+
+    //then the code writes
+    unsigned char count[8];
+    if (fread(count, 1, sizeof(count), file) != sizeof(count)) {
+        goto fail;
+    }
+    uint64_t writes = getLE(count, 8);
+    if (writes == TRACE_INDEX_NEVER) {
+        index->writesLost = 1;
+        writes = 0;
+    }
+    if (writes > SIZE_MAX / TRACE_INDEX_WRITE_SIZE) {
+        goto fail;
+    }
+    bytes = malloc(writes * TRACE_INDEX_WRITE_SIZE + 1);
+    index->writes = malloc(writes * sizeof(TraceCodeWrite) + 1);
+    index->writeCount = index->writeCapacity = writes;
+    if (bytes == NULL || index->writes == NULL
+            || fread(bytes, 1, writes * TRACE_INDEX_WRITE_SIZE, file) != writes * TRACE_INDEX_WRITE_SIZE) {
+        free(bytes);
+        goto fail;
+    }
+    for (size_t i = 0; i < writes; i++) {
+        const unsigned char* src = bytes + i * TRACE_INDEX_WRITE_SIZE;
+        index->writes[i].cycle = getLE(src, 8);
+        index->writes[i].address = getLE(src + 8, 2);
+        index->writes[i].value = getLE(src + 10, 2);
+    }
+    free(bytes);
+    fclose(file);
+    return index;
+
+fail:
+    if (index) {
+        FreeTraceIndex(index);
+    }
+    fclose(file);
+    return NULL;
+}
+
+/*
+ * Binary search for the last snapshot at or before cycle, NULL if there is none.
+ */
+const TraceIndexEntry* FindIndexEntry(const TraceIndex* index, uint64_t cycle) {
+    size_t low = 0;
+    size_t high = index->count;
+    //invariant: entries below low are at or before cycle, entries from high on are after it
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->entries[mid].cycle <= cycle) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low ? &index->entries[low - 1] : NULL;
+}
+
+/*
+ * Replay the code writes made before cycle onto memory.
+ */
+void ApplyCodeWrites(const TraceIndex* index, uint64_t cycle, unsigned short* memory) {
+    //writes are kept in cycle order
+    for (size_t i = 0; i < index->writeCount && index->writes[i].cycle < cycle; i++) {
+        memory[index->writes[i].address] = index->writes[i].value;
+    }
+}
+
+/*
+ * Free an index returned by LoadTraceIndex.
+ */
+void FreeTraceIndex(TraceIndex* index) {
+    free(index->writes);
+    free(index->entries);
+    free(index->firstCycle);
+    free(index);
+}
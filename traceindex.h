@@ -0,0 +1,153 @@
+/*
+ * traceindex.h: Declares the sidecar index that makes trace files seekable
+ *
+ * The index (trace file name + ".idx") maps every Nth cycle to the byte
+ * offset of its record together with the machine state before that cycle,
+ * and records the first cycle at which each PC was executed:
+ *
+ *   header   "LC4I", u16 version, u16 trace format, u32 interval,
+ *            u64 header bytes in the trace, u64 cycles, u64 entry count
+ *   entries  u64 cycle, u64 offset, u16 PC, u16 PSR, u16 R[0..7],
+ *            u16 PC of the record before (binary records are relative to it)
+ *   table    u64 first cycle of every PC 0000-FFFF (all ones if never executed)
+ *   writes   u64 count, then u64 cycle, u16 address, u16 value of every
+ *            store into an executable address (binary traces only)
+ *
+ * All values are little endian.
+ */
+
+#ifndef TRACEINDEX_H
+#define TRACEINDEX_H
+
+#include <stdint.h>
+#include "tracefmt.h"
+#include "bintrace.h"
+#include "decode.h"
+
+#define TRACE_INDEX_MAGIC "LC4I"
+#define TRACE_INDEX_VERSION 2
+#define TRACE_INDEX_HEADER_SIZE 36
+#define TRACE_INDEX_ENTRY_SIZE 38
+#define TRACE_INDEX_WRITE_SIZE 12
+#define TRACE_INDEX_NEVER UINT64_MAX
+
+typedef struct {
+    uint64_t cycle;
+    uint64_t offset;
+    unsigned short PC;
+    unsigned short PSR;
+    unsigned short R[8];
+    unsigned short lastPC;
+} TraceIndexEntry;
+
+// A store that rewrote code: binary readers resuming at a snapshot start from
+// the loaded image, so they replay these to fetch the right instructions
+typedef struct {
+    uint64_t cycle;
+    unsigned short address;
+    unsigned short value;
+} TraceCodeWrite;
+
+typedef struct {
+    FILE* file;
+    int format;
+    uint32_t interval;
+
+    // cycle of the next record, the cycle due for the next snapshot and
+    // the trace byte offset the next record will start at
+    uint64_t cycle;
+    uint64_t nextSnapshot;
+    uint64_t offset;
+    uint64_t headerBytes;
+
+    // PC of the previous record, binary record sizes depend on it
+    unsigned short lastPC;
+
+    TraceIndexEntry* entries;
+    size_t count;
+    size_t capacity;
+
+    uint64_t* firstCycle;
+
+    TraceCodeWrite* writes;
+    size_t writeCount;
+    size_t writeCapacity;
+
+    // set when a write could not be remembered, the index is then written
+    // with a write count of all ones
+    int writesLost;
+} TraceIndex;
+
+
+/*
+ * Start an index that snapshots every interval cycles, for a trace whose
+ * records start headerBytes into the file. Returns NULL if out of memory.
+ */
+TraceIndex* CreateTraceIndex(FILE* file, int format, uint32_t interval, uint64_t headerBytes);
+
+
+/*
+ * Snapshot the machine before the cycle it is about to execute.
+ */
+void TraceIndexSnapshot(TraceIndex* index, const MachineState* CPU);
+
+
+/*
+ * Remember that the record's store rewrote code.
+ */
+void TraceIndexCodeWrite(TraceIndex* index, const TraceRecord* rec);
+
+
+/*
+ * Account for one traced record.
+ */
+static inline void TraceIndexRecord(TraceIndex* index, const TraceRecord* rec) {
+    if (index->firstCycle[rec->PC] == TRACE_INDEX_NEVER) {
+        index->firstCycle[rec->PC] = index->cycle;
+    }
+    if (index->format == TRACE_TEXT) {
+        index->offset += TRACE_LINE_LENGTH;
+    } else {
+        //binary records do not carry the instruction, so rewritten code has to be remembered
+        if (rec->DATA_WE && IsExecutableAddress(rec->dmemAddr)) {
+            TraceIndexCodeWrite(index, rec);
+        }
+        //same size EncodeBinaryRecord produces
+        index->offset += 1 + (rec->PC != (unsigned short)(index->lastPC + 1)) * 2
+                           + (rec->regFile_WE ? 3 : 0) + (rec->DATA_WE ? 4 : 0);
+    }
+    index->lastPC = rec->PC;
+    index->cycle++;
+}
+
+
+/*
+ * Write the index file and free the index, returns 0 on success.
+ */
+int CloseTraceIndex(TraceIndex* index);
+
+
+/*
+ * Read an index file into memory, NULL if it is missing or malformed.
+ */
+TraceIndex* LoadTraceIndex(const char* filename);
+
+
+/*
+ * Binary search for the last snapshot at or before cycle, NULL if there is none.
+ */
+const TraceIndexEntry* FindIndexEntry(const TraceIndex* index, uint64_t cycle);
+
+
+/*
+ * Replay the code writes made before cycle onto memory.
+ */
+void ApplyCodeWrites(const TraceIndex* index, uint64_t cycle, unsigned short* memory);
+
+
+/*
+ * Free an index returned by LoadTraceIndex.
+ */
+void FreeTraceIndex(TraceIndex* index);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * tracepool.c: Defines the parallel trace formatter, which renders chunks of
+ * records on a pool of worker threads and writes them back in order
+ */
+
+#include "tracepool.h"
+#include "bintrace.h"
+#include "phases.h"
+
+//render all records of a chunk into its output buffer
+static void formatChunk(TracePool* pool, TraceChunk* chunk) {
+    PhaseScope scope = PhaseBegin();
+    char* dst = chunk->output;
+    if (pool->format == TRACE_TEXT) {
+        for (size_t i = 0; i < chunk->count; i++) {
+            FormatTraceLine(dst, &chunk->records[i]);
+            dst += TRACE_LINE_LENGTH;
+        }
+    } else {
+        unsigned short lastPC = chunk->lastPC;
+        for (size_t i = 0; i < chunk->count; i++) {
+            dst += EncodeBinaryRecord((unsigned char*)dst, &chunk->records[i], &lastPC);
+        }
+    }
+    chunk->outputUsed = dst - chunk->output;
+    PhaseEnd(PHASE_FORMAT, scope, chunk->count);
+}
+
+//worker thread: claim chunks in order of submission and render them
+static void* workerMain(void* arg) {
+    TracePool* pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        //chunks become ready in order, so everything below nextFill is ready to claim
+        while (pool->nextFormat == pool->nextFill && !pool->closing) {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        if (pool->nextFormat == pool->nextFill) {
+            break;
+        }
+        TraceChunk* chunk = &pool->chunks[pool->nextFormat % pool->slotCount];
+        pool->nextFormat++;
+        chunk->state = CHUNK_FORMATTING;
+        pthread_mutex_unlock(&pool->lock);
+
+        formatChunk(pool, chunk);
+
+        pthread_mutex_lock(&pool->lock);
+        chunk->state = CHUNK_DONE;
+        pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    MergeThreadPhases();
+    return NULL;
+}
+
+//writer thread: write rendered chunks strictly in submission order
+static void* writerMain(void* arg) {
+    TracePool* pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        TraceChunk* chunk = &pool->chunks[pool->nextWrite % pool->slotCount];
+        while (chunk->state != CHUNK_DONE && !(pool->closing && pool->nextWrite == pool->nextFill)) {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        if (chunk->state != CHUNK_DONE) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        PhaseScope scope = PhaseBegin();
+        int failed = fwrite(chunk->output, 1, chunk->outputUsed, pool->file) != chunk->outputUsed;
+        PhaseEnd(PHASE_WRITE, scope, chunk->outputUsed);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->failed |= failed;
+        chunk->count = 0;
+        chunk->state = CHUNK_FREE;
+        pool->nextWrite++;
+        pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    MergeThreadPhases();
+    return NULL;
+}
+
+//helper function to free a pool and its chunks
+static void freePool(TracePool* pool) {
+    for (int i = 0; i < pool->slotCount; i++) {
+        free(pool->chunks[i].records);
+        free(pool->chunks[i].output);
+    }
+    free(pool->chunks);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->changed);
+    free(pool);
+}
+
+/*
+ * Start workerCount formatting threads and an ordered writer thread for file.
+ */
+TracePool* StartTracePool(FILE* file, int format, int workerCount) {
+    if (workerCount < 1 || workerCount > TRACE_POOL_MAX_WORKERS) {
+        return NULL;
+    }
+    TracePool* pool = calloc(1, sizeof(TracePool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->file = file;
+    pool->format = format;
+    pool->lastPC = 0xFFFF;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+
+    //enough slots to keep every worker busy while others wait to be written
+    pool->slotCount = 2 * workerCount + 2;
+    pool->chunks = calloc(pool->slotCount, sizeof(TraceChunk));
+    if (pool->chunks == NULL) {
+        free(pool);
+        return NULL;
+    }
+    size_t recordBytes = pool->format == TRACE_TEXT ? TRACE_LINE_LENGTH : BINARY_RECORD_MAX;
+    for (int i = 0; i < pool->slotCount; i++) {
+        pool->chunks[i].records = malloc(TRACE_CHUNK_RECORDS * sizeof(TraceRecord));
+        pool->chunks[i].output = malloc(TRACE_CHUNK_RECORDS * recordBytes);
+        if (pool->chunks[i].records == NULL || pool->chunks[i].output == NULL) {
+            freePool(pool);
+            return NULL;
+        }
+    }
+    pool->current = &pool->chunks[0];
+    pool->current->state = CHUNK_FILLING;
+
+    if (pthread_create(&pool->writer, NULL, writerMain, pool) != 0) {
+        freePool(pool);
+        return NULL;
+    }
+    for (int i = 0; i < workerCount; i++) {
+        if (pthread_create(&pool->workers[i], NULL, workerMain, pool) != 0) {
+            //stop what was started, closing with no chunks lets every thread exit
+            CloseTracePool(pool);
+            return NULL;
+        }
+        pool->workerCount++;
+    }
+    return pool;
+}
+
+/*
+ * Hand a full chunk to the workers and move on to the next free slot.
+ */
+void SubmitTraceChunk(TracePool* pool) {
+    TraceChunk* chunk = pool->current;
+    chunk->lastPC = pool->lastPC;
+    pool->lastPC = chunk->records[chunk->count - 1].PC;
+
+    pthread_mutex_lock(&pool->lock);
+    chunk->state = CHUNK_READY;
+    pool->nextFill++;
+    pthread_cond_broadcast(&pool->changed);
+
+    //backpressure: wait for the writer to free the next slot
+    TraceChunk* next = &pool->chunks[pool->nextFill % pool->slotCount];
+    while (next->state != CHUNK_FREE) {
+        pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+    next->state = CHUNK_FILLING;
+    pool->current = next;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Submit the last partial chunk, wait until everything is written and stop the threads.
+ */
+int CloseTracePool(TracePool* pool) {
+    if (pool->current->count > 0) {
+        SubmitTraceChunk(pool);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = 1;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->workerCount; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    pthread_join(pool->writer, NULL);
+
+    int failed = pool->failed;
+    freePool(pool);
+    return failed ? -1 : 0;
+}
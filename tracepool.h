@@ -0,0 +1,105 @@
+/*
+ * tracepool.h: Declares the parallel trace formatter, which renders chunks of
+ * records on a pool of worker threads and writes them back in order
+ */
+
+#ifndef TRACEPOOL_H
+#define TRACEPOOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "tracefmt.h"
+
+// Records per chunk handed to a worker
+#define TRACE_CHUNK_RECORDS 16384
+
+// Upper limit on worker threads
+#define TRACE_POOL_MAX_WORKERS 64
+
+// Life cycle of a chunk slot
+enum {
+    CHUNK_FREE,         // written out, may be refilled
+    CHUNK_FILLING,      // the execution thread is adding records
+    CHUNK_READY,        // full, waiting for a worker
+    CHUNK_FORMATTING,   // a worker is rendering it
+    CHUNK_DONE          // rendered, waiting for its turn to be written
+};
+
+typedef struct {
+    TraceRecord* records;
+    size_t count;
+
+    // PC of the record before this chunk, binary records are delta encoded against it
+    unsigned short lastPC;
+
+    // rendered bytes
+    char* output;
+    size_t outputUsed;
+
+    int state;
+} TraceChunk;
+
+typedef struct {
+    FILE* file;
+    int format;
+
+    // chunk slots, chunk number n lives in slot n % slotCount
+    TraceChunk* chunks;
+    int slotCount;
+
+    // chunk the execution thread is filling
+    TraceChunk* current;
+
+    // chunk numbers: being filled, next to hand to a worker, next to write
+    uint64_t nextFill;
+    uint64_t nextFormat;
+    uint64_t nextWrite;
+
+    // PC of the last record submitted
+    unsigned short lastPC;
+
+    // one lock and condition for all slot state changes, they only happen once per chunk
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int closing;
+    int failed;
+
+    pthread_t workers[TRACE_POOL_MAX_WORKERS];
+    int workerCount;
+    pthread_t writer;
+} TracePool;
+
+
+/*
+ * Start workerCount formatting threads and an ordered writer thread for file.
+ * Returns NULL if they could not be started.
+ */
+TracePool* StartTracePool(FILE* file, int format, int workerCount);
+
+
+/*
+ * Hand a full chunk to the workers and move on to the next free slot,
+ * waiting for one if the writer is behind.
+ */
+void SubmitTraceChunk(TracePool* pool);
+
+
+/*
+ * Add one record to the chunk being filled.
+ */
+static inline void TracePoolPush(TracePool* pool, const TraceRecord* rec) {
+    TraceChunk* chunk = pool->current;
+    chunk->records[chunk->count++] = *rec;
+    if (chunk->count == TRACE_CHUNK_RECORDS) {
+        SubmitTraceChunk(pool);
+    }
+}
+
+
+/*
+ * Submit the last partial chunk, wait until everything is written and stop
+ * the threads. Returns 0 if every write succeeded.
+ */
+int CloseTracePool(TracePool* pool);
+
+#endif
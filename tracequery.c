@@ -0,0 +1,143 @@
+/*
+ * tracequery.c: jumps to a cycle of a trace through its sidecar index
+ */
+
+#include "traceindex.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//helper function to print how to run the query tool
+void printUsage(char* name) {
+    printf("Usage: %s trace_file (cycle N | pc XXXX) [count]\n", name);
+    printf("  cycle  print the trace from cycle N (counting from 0)\n");
+    printf("  pc     print the trace from the first cycle that executed PC XXXX (hex)\n");
+    printf("  count  number of cycles to print (default 1)\n");
+    printf("The index is read from trace_file.idx, written by trace -i.\n");
+}
+
+//helper function to print the text lines of count cycles of a text trace starting at offset
+static void printTextLines(const unsigned char* data, size_t size, uint64_t offset, uint64_t count) {
+    while (count-- && offset + TRACE_LINE_LENGTH <= size) {
+        fwrite(data + offset, 1, TRACE_LINE_LENGTH, stdout);
+        offset += TRACE_LINE_LENGTH;
+    }
+}
+
+//helper function to decode a binary trace from an indexed record on, skipping skip records and printing count
+static int printBinaryLines(const unsigned char* data, size_t size, const TraceIndex* index,
+                            const TraceIndexEntry* entry, uint64_t skip, uint64_t count) {
+    BinaryTraceReader* reader = malloc(sizeof(BinaryTraceReader));
+    if (reader == NULL || OpenBinaryTrace(reader, data, size) != 0) {
+        free(reader);
+        return -1;
+    }
+    //resume at the record, with the code the program rewrote before it
+    ApplyCodeWrites(index, entry ? entry->cycle : 0, reader->memory);
+    reader->pos = entry ? entry->offset : index->headerBytes;
+    reader->lastPC = entry ? entry->lastPC : 0xFFFF;
+    TraceRecord rec;
+    char line[TRACE_LINE_LENGTH];
+    int status = 1;
+    while (status == 1 && count) {
+        status = ReadBinaryRecord(reader, &rec);
+        if (status == 1 && skip) {
+            skip--;
+        } else if (status == 1) {
+            FormatTraceLine(line, &rec);
+            fwrite(line, 1, TRACE_LINE_LENGTH, stdout);
+            count--;
+        }
+    }
+    free(reader);
+    return status < 0 ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4 && argc != 5) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    //load the index sitting next to the trace
+    char* indexFilename = malloc(strlen(argv[1]) + 5);
+    sprintf(indexFilename, "%s.idx", argv[1]);
+    TraceIndex* index = LoadTraceIndex(indexFilename);
+    if (index == NULL) {
+        printf("Error: could not read index %s\n", indexFilename);
+        return -1;
+    }
+
+    //work out which cycle was asked for
+    uint64_t cycle;
+    if (strcmp(argv[2], "cycle") == 0) {
+        cycle = strtoull(argv[3], NULL, 0);
+    } else if (strcmp(argv[2], "pc") == 0) {
+        unsigned long pc = strtoul(argv[3], NULL, 16);
+        if (pc > 0xFFFF || index->firstCycle[pc] == TRACE_INDEX_NEVER) {
+            printf("PC %s was never executed\n", argv[3]);
+            return 1;
+        }
+        cycle = index->firstCycle[pc];
+    } else {
+        printUsage(argv[0]);
+        return -1;
+    }
+    uint64_t count = argc == 5 ? strtoull(argv[4], NULL, 0) : 1;
+    if (cycle >= index->cycle) {
+        printf("Cycle %llu is past the end of the trace (%llu cycles)\n",
+               (unsigned long long)cycle, (unsigned long long)index->cycle);
+        return 1;
+    }
+
+    //map the trace
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening trace");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        printf("Error: %s is empty or unreadable\n", argv[1]);
+        return -1;
+    }
+    unsigned char* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("Error mapping trace");
+        return -1;
+    }
+    close(fd);
+
+    //the nearest snapshot at or before the cycle gives the registers and where to start reading
+    const TraceIndexEntry* entry = FindIndexEntry(index, cycle);
+    printf("cycle %llu", (unsigned long long)cycle);
+    if (entry) {
+        printf(", snapshot at cycle %llu: PC=%04X PSR=%04X", (unsigned long long)entry->cycle, entry->PC, entry->PSR);
+        for (int r = 0; r < 8; r++) {
+            printf(" R%d=%04X", r, entry->R[r]);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+
+    int status = 0;
+    if (index->format == TRACE_TEXT) {
+        //text lines all have the same width, so the offset is known without the snapshot
+        printTextLines(data, info.st_size, index->headerBytes + cycle * TRACE_LINE_LENGTH, count);
+    } else {
+        //binary records vary in size: decode forward from the snapshot
+        if (index->writesLost) {
+            fprintf(stderr, "Warning: the index lost track of rewritten code, instructions may show stale bits\n");
+        }
+        status = printBinaryLines(data, info.st_size, index, entry, cycle - (entry ? entry->cycle : 0), count);
+        if (status != 0) {
+            printf("Error: %s is truncated or corrupt\n", argv[1]);
+        }
+    }
+
+    munmap(data, info.st_size);
+    FreeTraceIndex(index);
+    free(indexFilename);
+    return status;
+}
@@ -0,0 +1,168 @@
+/*
+ * tracewriter.c: Defines the buffered trace writer used by the execution engines
+ */
+
+#include "tracewriter.h"
+
+/*
+ * Create a trace writer for an open file, NULL if out of memory or the header
+ * could not be written.
+ */
+TraceWriter* CreateTraceWriter(FILE* file, int format, const MachineState* CPU) {
+    TraceWriter* trace = malloc(sizeof(TraceWriter));
+    if (trace == NULL) {
+        return NULL;
+    }
+    trace->buffer = malloc(TRACE_BUFFER_SIZE);
+    if (trace->buffer == NULL) {
+        free(trace);
+        return NULL;
+    }
+    trace->file = file;
+    trace->format = format;
+    trace->used = 0;
+    trace->lastPC = 0xFFFF;
+    trace->failed = 0;
+    trace->ring = NULL;
+    trace->pool = NULL;
+    trace->index = NULL;
+
+    //binary traces start with the memory image so the converter can recover the instructions
+    if (format == TRACE_BINARY && WriteBinaryTraceHeader(file, CPU) != 0) {
+        free(trace->buffer);
+        free(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+//writer thread: drain the ring, rendering and writing records until the producer closes it
+static void* traceThreadMain(void* arg) {
+    TraceWriter* trace = arg;
+    TraceRing* ring = trace->ring;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (1) {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == head) {
+            //check closing before looking at head again so no record is left behind
+            if (atomic_load_explicit(&ring->closing, memory_order_acquire)
+                    && atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        PhaseScope scope = PhaseBegin();
+        uint64_t count = head - tail;
+        while (tail != head) {
+            TraceRenderRecord(trace, &ring->records[tail & (TRACE_RING_SIZE - 1)]);
+            tail++;
+        }
+        PhaseEnd(PHASE_FORMAT, scope, count);
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    FlushTraceWriter(trace);
+    MergeThreadPhases();
+    return NULL;
+}
+
+/*
+ * Hand rendering and writing over to a dedicated writer thread.
+ */
+int StartTraceThread(TraceWriter* trace) {
+    //head and tail sit on their own cache lines, so keep the ring aligned to them
+    TraceRing* ring = aligned_alloc(64, sizeof(TraceRing));
+    if (ring == NULL) {
+        return -1;
+    }
+    memset(ring, 0, sizeof(TraceRing));
+    ring->records = malloc(TRACE_RING_SIZE * sizeof(TraceRecord));
+    if (ring->records == NULL) {
+        free(ring);
+        return -1;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->closing, 0);
+    ring->cachedTail = 0;
+    trace->ring = ring;
+    if (pthread_create(&ring->thread, NULL, traceThreadMain, trace) != 0) {
+        trace->ring = NULL;
+        free(ring->records);
+        free(ring);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Render the trace on workerCount threads in chunks, written back in order.
+ */
+int StartTraceWorkers(TraceWriter* trace, int workerCount) {
+    //anything already rendered must reach the file before the first chunk
+    FlushTraceWriter(trace);
+    trace->pool = StartTracePool(trace->file, trace->format, workerCount);
+    return trace->pool ? 0 : -1;
+}
+
+/*
+ * Keep a sidecar index with a snapshot every interval cycles.
+ */
+int StartTraceIndex(TraceWriter* trace, FILE* indexFile, uint32_t interval) {
+    //records start after whatever header was written, buffered or not
+    long position = ftell(trace->file);
+    if (position < 0 || interval == 0) {
+        return -1;
+    }
+    trace->index = CreateTraceIndex(indexFile, trace->format, interval, position + trace->used);
+    return trace->index ? 0 : -1;
+}
+
+/*
+ * Write out everything buffered so far, returns 0 on success.
+ * Only the thread rendering the trace may call this.
+ */
+int FlushTraceWriter(TraceWriter* trace) {
+    PhaseScope scope = PhaseBegin();
+    if (fwrite(trace->buffer, 1, trace->used, trace->file) != trace->used) {
+        trace->failed = 1;
+    }
+    PhaseEnd(PHASE_WRITE, scope, trace->used);
+    trace->used = 0;
+    return trace->failed ? -1 : 0;
+}
+
+/*
+ * Finish the trace (draining and stopping the writer thread if there is one),
+ * flush and free the writer (the file stays open), returns 0 if every write succeeded.
+ */
+int CloseTraceWriter(TraceWriter* trace) {
+    //let the writer thread drain what is queued, after that this thread owns the buffer again
+    if (trace->ring) {
+        atomic_store_explicit(&trace->ring->closing, 1, memory_order_release);
+        pthread_join(trace->ring->thread, NULL);
+        free(trace->ring->records);
+        free(trace->ring);
+        trace->ring = NULL;
+    }
+    //same for the formatting workers
+    if (trace->pool) {
+        if (CloseTracePool(trace->pool) != 0) {
+            trace->failed = 1;
+        }
+        trace->pool = NULL;
+    }
+    if (trace->format == TRACE_BINARY) {
+        if (trace->used == TRACE_BUFFER_SIZE) {
+            FlushTraceWriter(trace);
+        }
+        trace->buffer[trace->used++] = (char)BINARY_TRACE_END;
+    }
+    int result = FlushTraceWriter(trace);
+    if (trace->index && CloseTraceIndex(trace->index) != 0) {
+        result = -1;
+    }
+    free(trace->buffer);
+    free(trace);
+    return result;
+}
@@ -0,0 +1,170 @@
+/*
+ * tracewriter.h: Declares the buffered trace writer used by the execution engines
+ */
+
+#ifndef TRACEWRITER_H
+#define TRACEWRITER_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "tracefmt.h"
+#include "bintrace.h"
+#include "tracepool.h"
+#include "traceindex.h"
+#include "phases.h"
+
+// Size of the user-space buffer trace lines are rendered into before each write
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+// Number of records the asynchronous ring holds (a power of two)
+#define TRACE_RING_SIZE (1 << 16)
+
+// Single-producer/single-consumer ring between the execution thread and the writer thread
+typedef struct {
+    TraceRecord* records;
+
+    // next slot the producer fills, and the producer's last view of tail
+    _Alignas(64) _Atomic size_t head;
+    size_t cachedTail;
+
+    // next slot the consumer drains
+    _Alignas(64) _Atomic size_t tail;
+
+    // set by the producer once no more records will come
+    _Atomic int closing;
+
+    pthread_t thread;
+} TraceRing;
+
+typedef struct {
+    // file the trace goes to, owned by the caller
+    FILE* file;
+    int format;
+
+    // rendered lines (or encoded records) waiting to be written
+    char* buffer;
+    size_t used;
+
+    // PC of the previous binary record
+    unsigned short lastPC;
+
+    // set once any write has failed
+    int failed;
+
+    // when not NULL, records go through this ring to a writer thread that
+    // renders and writes them
+    TraceRing* ring;
+
+    // when not NULL, records are batched into chunks rendered in parallel
+    TracePool* pool;
+
+    // when not NULL, the sidecar index kept alongside the trace
+    TraceIndex* index;
+} TraceWriter;
+
+
+/*
+ * Create a trace writer for an open file, NULL if out of memory or the header
+ * could not be written. CPU is the machine about to run: a binary trace
+ * records its memory image in the header.
+ */
+TraceWriter* CreateTraceWriter(FILE* file, int format, const MachineState* CPU);
+
+
+/*
+ * Hand rendering and writing over to a dedicated writer thread, so the
+ * execution thread only copies fixed-size records into a lock-free ring.
+ * Returns 0 on success.
+ */
+int StartTraceThread(TraceWriter* trace);
+
+
+/*
+ * Render the trace on workerCount threads in chunks, written back in order
+ * so the file is identical to the sequential one. Returns 0 on success.
+ */
+int StartTraceWorkers(TraceWriter* trace, int workerCount);
+
+
+/*
+ * Keep a sidecar index in indexFile (owned by the caller) with a snapshot
+ * every interval cycles. Call before the first cycle; needs a seekable trace
+ * file. Returns 0 on success.
+ */
+int StartTraceIndex(TraceWriter* trace, FILE* indexFile, uint32_t interval);
+
+
+/*
+ * Write out everything buffered so far, returns 0 on success.
+ * Only the thread rendering the trace may call this.
+ */
+int FlushTraceWriter(TraceWriter* trace);
+
+
+/*
+ * Finish the trace (draining and stopping the writer thread if there is one),
+ * flush and free the writer (the file stays open), returns 0 if every write succeeded.
+ */
+int CloseTraceWriter(TraceWriter* trace);
+
+
+/*
+ * Render one cycle into the buffer.
+ */
+static inline void TraceRenderRecord(TraceWriter* trace, const TraceRecord* rec) {
+    if (TRACE_BUFFER_SIZE - trace->used < TRACE_LINE_LENGTH) {
+        FlushTraceWriter(trace);
+    }
+    if (trace->format == TRACE_TEXT) {
+        FormatTraceLine(trace->buffer + trace->used, rec);
+        trace->used += TRACE_LINE_LENGTH;
+    } else {
+        trace->used += EncodeBinaryRecord((unsigned char*)trace->buffer + trace->used, rec, &trace->lastPC);
+    }
+}
+
+
+/*
+ * Queue one record for the writer thread, waiting while the ring is full.
+ */
+static inline void TracePushRecord(TraceRing* ring, const TraceRecord* rec) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->cachedTail == TRACE_RING_SIZE) {
+        //backpressure: let the writer thread catch up
+        while ((ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire)) + TRACE_RING_SIZE == head) {
+            sched_yield();
+        }
+    }
+    ring->records[head & (TRACE_RING_SIZE - 1)] = *rec;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+/*
+ * Trace one cycle.
+ */
+static inline void TraceEmitRecord(TraceWriter* trace, const TraceRecord* rec) {
+    if (trace->index) {
+        TraceIndexRecord(trace->index, rec);
+    }
+    if (trace->pool) {
+        TracePoolPush(trace->pool, rec);
+    } else if (trace->ring) {
+        TracePushRecord(trace->ring, rec);
+    } else {
+        TraceRenderRecord(trace, rec);
+    }
+}
+
+
+/*
+ * Trace the cycle the CPU has just executed.
+ */
+static inline void TraceEmitState(TraceWriter* trace, const MachineState* CPU) {
+    TraceRecord rec;
+    RecordFromState(CPU, &rec);
+    TraceEmitRecord(trace, &rec);
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * undo.c: Defines the undo log that lets a stopped machine run backwards
+ */
+
+#include "undo.h"
+
+const unsigned char UndoKind[OP_COUNT] = {
+    [OP_ADD] = UNDO_RD,
+    [OP_MUL] = UNDO_RD,
+    [OP_SUB] = UNDO_RD,
+    [OP_DIV] = UNDO_RD,
+    [OP_ADDI] = UNDO_RD,
+    [OP_AND] = UNDO_RD,
+    [OP_NOT] = UNDO_RD,
+    [OP_OR] = UNDO_RD,
+    [OP_XOR] = UNDO_RD,
+    [OP_ANDI] = UNDO_RD,
+    [OP_LDR] = UNDO_RD,
+    [OP_CONST] = UNDO_RD,
+    [OP_SLL] = UNDO_RD,
+    [OP_SRA] = UNDO_RD,
+    [OP_SRL] = UNDO_RD,
+    [OP_MOD] = UNDO_RD,
+    [OP_HICONST] = UNDO_RD,
+    [OP_JSRR] = UNDO_R7,
+    [OP_JSR] = UNDO_R7,
+    [OP_TRAP] = UNDO_R7,
+    [OP_STR] = UNDO_MEMORY,
+};
+
+/*
+ * Create a log keeping at least history cycles.
+ */
+UndoLog* CreateUndoLog(uint64_t history) {
+    //the ring is rounded up to a power of two, which must neither wrap nor overflow the allocation
+    if (history > UNDO_MAX_HISTORY) {
+        return NULL;
+    }
+    uint64_t size = 1;
+    while (size < history) {
+        size *= 2;
+    }
+    if (size > SIZE_MAX / sizeof(UndoRecord)) {
+        return NULL;
+    }
+    UndoLog* undo = malloc(sizeof(UndoLog));
+    if (undo == NULL) {
+        return NULL;
+    }
+    undo->records = malloc(size * sizeof(UndoRecord));
+    if (undo->records == NULL) {
+        free(undo);
+        return NULL;
+    }
+    undo->mask = size - 1;
+    undo->head = 0;
+    undo->depth = 0;
+    return undo;
+}
+
+/*
+ * Undo up to n cycles, returns how many were undone.
+ */
+uint64_t StepBack(UndoLog* undo, MachineState* CPU, uint64_t n) {
+    uint64_t done = 0;
+    while (done < n && undo->depth) {
+        undo->head--;
+        undo->depth--;
+        const UndoRecord* rec = &undo->records[undo->head & undo->mask];
+        if (rec->kind == UNDO_RD || rec->kind == UNDO_R7) {
+            CPU->R[rec->where] = rec->old;
+        } else if (rec->kind == UNDO_MEMORY) {
+            //the word may be code again, so its decoded copy has to go
+            CPU->memory[rec->where] = rec->old;
+            MarkWritten(CPU, rec->where);
+            InvalidateDecoded(CPU, rec->where);
+        }
+        CPU->PC = rec->PC;
+        CPU->PSR = rec->PSR;
+        done++;
+    }
+    return done;
+}
+
+/*
+ * Undo cycles until the machine is back before the latest execution of pc.
+ */
+uint64_t RunBackTo(UndoLog* undo, MachineState* CPU, unsigned short pc) {
+    //find it first, so a miss leaves the machine alone
+    for (uint64_t back = 1; back <= undo->depth; back++) {
+        if (undo->records[(undo->head - back) & undo->mask].PC == pc) {
+            return StepBack(undo, CPU, back);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Free the log.
+ */
+void FreeUndoLog(UndoLog* undo) {
+    free(undo->records);
+    free(undo);
+}
@@ -0,0 +1,114 @@
+/*
+ * undo.h: Declares the undo log that lets a stopped machine run backwards
+ *
+ * While recording, every cycle stores what it is about to overwrite: the PC
+ * and PSR, plus the old value of the one register or memory word the
+ * instruction writes. The log is a ring, so only the most recent cycles can
+ * be undone; go further back by restoring a checkpoint (see checkpoint.h).
+ */
+
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stdint.h>
+#include "LC4.h"
+#include "decode.h"
+
+// Longest history a log may keep (a few GB of records)
+#define UNDO_MAX_HISTORY (1ULL << 28)
+
+// What an instruction overwrites besides PC and PSR
+enum {
+    UNDO_NONE,      // nothing (branches, compares, jumps, RTI)
+    UNDO_RD,        // register rd
+    UNDO_R7,        // R7, with the return address
+    UNDO_MEMORY     // the memory word at R[rs] + imm
+};
+
+typedef struct {
+    unsigned short PC;
+    unsigned short PSR;
+    // register number or memory address, and the value it held
+    unsigned short where;
+    unsigned short old;
+    unsigned char kind;
+} UndoRecord;
+
+typedef struct {
+    UndoRecord* records;
+    // the ring holds mask + 1 records (a power of two)
+    uint64_t mask;
+    // cycles recorded so far, the slot at head is the cycle being executed
+    uint64_t head;
+    // cycles that can still be undone
+    uint64_t depth;
+} UndoLog;
+
+// UNDO_ kind of every operation
+extern const unsigned char UndoKind[OP_COUNT];
+
+
+/*
+ * Create a log keeping at least history cycles, NULL if out of memory or
+ * history is above UNDO_MAX_HISTORY.
+ */
+UndoLog* CreateUndoLog(uint64_t history);
+
+
+/*
+ * Record what the instruction at PC is about to overwrite, in the slot of the
+ * cycle being executed; it only counts once UndoCommit is called.
+ */
+static inline void UndoCapture(UndoLog* undo, const MachineState* CPU, const DecodedInsn* insn) {
+    UndoRecord* rec = &undo->records[undo->head & undo->mask];
+    rec->PC = CPU->PC;
+    rec->PSR = CPU->PSR;
+    rec->kind = UndoKind[insn->op];
+    switch (rec->kind) {
+        case UNDO_RD:
+            rec->where = insn->rd;
+            rec->old = CPU->R[insn->rd];
+            break;
+        case UNDO_R7:
+            rec->where = 7;
+            rec->old = CPU->R[7];
+            break;
+        case UNDO_MEMORY:
+            rec->where = CPU->R[insn->rs] + insn->imm;
+            rec->old = CPU->memory[rec->where];
+            break;
+    }
+}
+
+
+/*
+ * The captured cycle completed.
+ */
+static inline void UndoCommit(UndoLog* undo) {
+    undo->head++;
+    if (undo->depth <= undo->mask) {
+        undo->depth++;
+    }
+}
+
+
+/*
+ * Undo up to n cycles, returns how many were undone.
+ */
+uint64_t StepBack(UndoLog* undo, MachineState* CPU, uint64_t n);
+
+
+/*
+ * Undo cycles until the machine is back before the latest execution of the
+ * instruction at pc. Returns the number of cycles undone, or 0 (changing
+ * nothing) if pc was not executed within the history.
+ */
+uint64_t RunBackTo(UndoLog* undo, MachineState* CPU, unsigned short pc);
+
+
+/*
+ * Free the log.
+ */
+void FreeUndoLog(UndoLog* undo);
+
+#endif